@@ -0,0 +1,317 @@
+// BLAKE3, unkeyed, 32 bytes out: a streaming implementation of
+// https://github.com/BLAKE3-team/BLAKE3-specs giving the same values as
+// blake3_hasher_finalize().  Runs of whole chunks are compressed 8 or 16 at
+// a time with AVX2 or AVX-512, once blake3_select() has found them.
+// Header only, for udf_fingerprint.
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLAKE3_X86
+#include <immintrin.h>
+#endif
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+#define BLAKE3_MAX_LANES 16
+
+#define BLAKE3_CHUNK_START 1
+#define BLAKE3_CHUNK_END 2
+#define BLAKE3_PARENT 4
+#define BLAKE3_ROOT 8
+
+static const uint32_t blake3_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// Message word order of each round
+static const unsigned char blake3_schedule[7][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+struct blake3_state {
+	uint32_t cv[8];      // Of the chunk being hashed
+	uint64_t chunk;      // Its counter
+	unsigned char block[BLAKE3_BLOCK_LEN];
+	size_t block_len;
+	unsigned int blocks; // Of the chunk compressed so far
+	uint32_t stack[BLAKE3_MAX_DEPTH][8]; // Subtrees not merged yet
+	unsigned int depth;
+};
+
+// Compress lanes whole chunks starting at chunk counter into their chaining values
+typedef void (*blake3_chunks_fn)(const unsigned char *, uint64_t, uint32_t (*)[8]);
+
+static inline uint32_t blake3_read32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t blake3_rotr32(uint32_t v, int r) {
+	return (v >> r) | (v << (32 - r));
+}
+
+#define BLAKE3_G(v, a, b, c, d, x, y) do { \
+	v[a] += v[b] + (x); v[d] = blake3_rotr32(v[d] ^ v[a], 16); \
+	v[c] += v[d];       v[b] = blake3_rotr32(v[b] ^ v[c], 12); \
+	v[a] += v[b] + (y); v[d] = blake3_rotr32(v[d] ^ v[a], 8);  \
+	v[c] += v[d];       v[b] = blake3_rotr32(v[b] ^ v[c], 7);  \
+} while (0)
+
+static void blake3_compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter,
+                            uint32_t len, uint32_t flags, uint32_t out[16]) {
+	const unsigned char *s;
+	uint32_t v[16];
+	int r, i;
+
+	memcpy(v, cv, 8 * sizeof(*v));
+	memcpy(v + 8, blake3_iv, 4 * sizeof(*v));
+	v[12] = (uint32_t)counter;
+	v[13] = (uint32_t)(counter >> 32);
+	v[14] = len;
+	v[15] = flags;
+	for (r = 0; r < 7; r++) {
+		s = blake3_schedule[r];
+		BLAKE3_G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+		BLAKE3_G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+		BLAKE3_G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+		BLAKE3_G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+		BLAKE3_G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+		BLAKE3_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+		BLAKE3_G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+		BLAKE3_G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+	}
+	for (i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+static void blake3_compress_block(uint32_t cv[8], const unsigned char *block, uint64_t counter,
+                                  uint32_t len, uint32_t flags) {
+	uint32_t m[16], out[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = blake3_read32(block + 4 * i);
+	blake3_compress(cv, m, counter, len, flags, out);
+	memcpy(cv, out, 8 * sizeof(*cv));
+}
+
+#ifdef BLAKE3_X86
+#define BLAKE3_VG(ADD, XOR, ROTR, a, b, c, d, x, y) do { \
+	v[a] = ADD(ADD(v[a], v[b]), (x)); v[d] = ROTR(XOR(v[d], v[a]), 16); \
+	v[c] = ADD(v[c], v[d]);           v[b] = ROTR(XOR(v[b], v[c]), 12); \
+	v[a] = ADD(ADD(v[a], v[b]), (y)); v[d] = ROTR(XOR(v[d], v[a]), 8);  \
+	v[c] = ADD(v[c], v[d]);           v[b] = ROTR(XOR(v[b], v[c]), 7);  \
+} while (0)
+
+// Lane i hashes the chunk at p + i * BLAKE3_CHUNK_LEN; message words are
+// gathered across the lanes.  One function per width, the same rounds.
+#define BLAKE3_SIMD_CHUNKS(NAME, TARGET, LANES, VEC, ADD, XOR, ROTR, SET1, GATHER, LOAD, STORE) \
+__attribute__((target(TARGET))) \
+static void NAME(const unsigned char *p, uint64_t chunk, uint32_t (*cvs)[8]) { \
+	uint32_t words[8][LANES] __attribute__((aligned(64))); \
+	uint32_t lo[LANES] __attribute__((aligned(64))); \
+	uint32_t hi[LANES] __attribute__((aligned(64))); \
+	uint32_t offsets[LANES] __attribute__((aligned(64))); \
+	VEC v[16], m[16], cv[8], lanes, counter_lo, counter_hi; \
+	const unsigned char *s; \
+	int b, r, i, j; \
+	\
+	for (i = 0; i < LANES; i++) { \
+		lo[i] = (uint32_t)(chunk + i); \
+		hi[i] = (uint32_t)((chunk + i) >> 32); \
+		offsets[i] = i * (BLAKE3_CHUNK_LEN / 4); \
+	} \
+	lanes = LOAD(offsets); \
+	counter_lo = LOAD(lo); \
+	counter_hi = LOAD(hi); \
+	for (i = 0; i < 8; i++) \
+		cv[i] = SET1(blake3_iv[i]); \
+	for (b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) { \
+		for (i = 0; i < 16; i++) \
+			m[i] = GATHER(lanes, p + b * BLAKE3_BLOCK_LEN + 4 * i); \
+		for (i = 0; i < 8; i++) \
+			v[i] = cv[i]; \
+		for (i = 0; i < 4; i++) \
+			v[i + 8] = SET1(blake3_iv[i]); \
+		v[12] = counter_lo; \
+		v[13] = counter_hi; \
+		v[14] = SET1(BLAKE3_BLOCK_LEN); \
+		v[15] = SET1((b == 0 ? BLAKE3_CHUNK_START : 0) | \
+		             (b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? BLAKE3_CHUNK_END : 0)); \
+		for (r = 0; r < 7; r++) { \
+			s = blake3_schedule[r]; \
+			BLAKE3_VG(ADD, XOR, ROTR, 0, 4, 8, 12, m[s[0]], m[s[1]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 1, 5, 9, 13, m[s[2]], m[s[3]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 2, 6, 10, 14, m[s[4]], m[s[5]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 3, 7, 11, 15, m[s[6]], m[s[7]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 0, 5, 10, 15, m[s[8]], m[s[9]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 1, 6, 11, 12, m[s[10]], m[s[11]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 2, 7, 8, 13, m[s[12]], m[s[13]]); \
+			BLAKE3_VG(ADD, XOR, ROTR, 3, 4, 9, 14, m[s[14]], m[s[15]]); \
+		} \
+		for (i = 0; i < 8; i++) \
+			cv[i] = XOR(v[i], v[i + 8]); \
+	} \
+	for (i = 0; i < 8; i++) \
+		STORE(words[i], cv[i]); \
+	for (j = 0; j < LANES; j++) \
+		for (i = 0; i < 8; i++) \
+			cvs[j][i] = words[i][j]; \
+}
+
+#define BLAKE3_AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define BLAKE3_AVX2_GATHER(idx, p) _mm256_i32gather_epi32((const int *)(p), (idx), 4)
+#define BLAKE3_AVX2_LOAD(p) _mm256_load_si256((const __m256i *)(p))
+#define BLAKE3_AVX2_STORE(p, x) _mm256_store_si256((__m256i *)(p), (x))
+#define BLAKE3_AVX512_GATHER(idx, p) _mm512_i32gather_epi32((idx), (const void *)(p), 4)
+#define BLAKE3_AVX512_LOAD(p) _mm512_load_si512((const void *)(p))
+#define BLAKE3_AVX512_STORE(p, x) _mm512_store_si512((void *)(p), (x))
+
+BLAKE3_SIMD_CHUNKS(blake3_chunks_avx2, "avx2", 8, __m256i, _mm256_add_epi32, _mm256_xor_si256,
+                   BLAKE3_AVX2_ROTR, _mm256_set1_epi32, BLAKE3_AVX2_GATHER, BLAKE3_AVX2_LOAD, BLAKE3_AVX2_STORE)
+BLAKE3_SIMD_CHUNKS(blake3_chunks_avx512, "avx512f", 16, __m512i, _mm512_add_epi32, _mm512_xor_si512,
+                   _mm512_ror_epi32, _mm512_set1_epi32, BLAKE3_AVX512_GATHER, BLAKE3_AVX512_LOAD, BLAKE3_AVX512_STORE)
+#endif
+
+// Chunks per SIMD call, 1 without one
+static unsigned int blake3_lanes = 1;
+static blake3_chunks_fn blake3_chunks = NULL;
+
+// Pick the widest chunk path the CPU runs; call before any thread hashes
+static void blake3_select(void) {
+#ifdef BLAKE3_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		blake3_chunks = blake3_chunks_avx512;
+		blake3_lanes = 16;
+	} else if (__builtin_cpu_supports("avx2")) {
+		blake3_chunks = blake3_chunks_avx2;
+		blake3_lanes = 8;
+	}
+#endif
+}
+
+static void blake3_init(struct blake3_state *state) {
+	memcpy(state->cv, blake3_iv, sizeof(state->cv));
+	state->chunk = 0;
+	state->block_len = 0;
+	state->blocks = 0;
+	state->depth = 0;
+}
+
+// Add the chaining value of a finished chunk, total being the chunks so
+// far, and merge the subtrees it completes
+static void blake3_push(struct blake3_state *state, const uint32_t cv[8], uint64_t total) {
+	uint32_t m[16], out[16];
+
+	memcpy(m + 8, cv, 8 * sizeof(*m));
+	while ((total & 1) == 0) {
+		memcpy(m, state->stack[--state->depth], 8 * sizeof(*m));
+		blake3_compress(blake3_iv, m, 0, BLAKE3_BLOCK_LEN, BLAKE3_PARENT, out);
+		memcpy(m + 8, out, 8 * sizeof(*m));
+		total >>= 1;
+	}
+	memcpy(state->stack[state->depth++], m + 8, 8 * sizeof(*m));
+}
+
+static void blake3_update(struct blake3_state *state, const void *data, size_t len) {
+	const unsigned char *p = data;
+	uint32_t cvs[BLAKE3_MAX_LANES][8];
+	unsigned int i;
+	size_t n;
+
+	while (len > 0) {
+		// Whole chunks side by side, as long as more input follows them
+		if (blake3_lanes > 1 && state->blocks == 0 && state->block_len == 0 &&
+		    len > blake3_lanes * BLAKE3_CHUNK_LEN) {
+			blake3_chunks(p, state->chunk, cvs);
+			for (i = 0; i < blake3_lanes; i++)
+				blake3_push(state, cvs[i], state->chunk + i + 1);
+			state->chunk += blake3_lanes;
+			p += blake3_lanes * BLAKE3_CHUNK_LEN;
+			len -= blake3_lanes * BLAKE3_CHUNK_LEN;
+			continue;
+		}
+
+		// Blocks are only compressed once more input follows, the last
+		// of a chunk and of the input are special
+		if (state->block_len == BLAKE3_BLOCK_LEN) {
+			if (state->blocks == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1) {
+				blake3_compress_block(state->cv, state->block, state->chunk, BLAKE3_BLOCK_LEN, BLAKE3_CHUNK_END);
+				blake3_push(state, state->cv, ++state->chunk);
+				memcpy(state->cv, blake3_iv, sizeof(state->cv));
+				state->blocks = 0;
+			} else {
+				blake3_compress_block(state->cv, state->block, state->chunk, BLAKE3_BLOCK_LEN,
+				                      state->blocks ? 0 : BLAKE3_CHUNK_START);
+				state->blocks++;
+			}
+			state->block_len = 0;
+			continue;
+		}
+
+		// Straight from the input, when the block can't be the chunk's last
+		if (state->block_len == 0 && len > BLAKE3_BLOCK_LEN &&
+		    state->blocks < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1) {
+			blake3_compress_block(state->cv, p, state->chunk, BLAKE3_BLOCK_LEN,
+			                      state->blocks ? 0 : BLAKE3_CHUNK_START);
+			state->blocks++;
+			p += BLAKE3_BLOCK_LEN;
+			len -= BLAKE3_BLOCK_LEN;
+			continue;
+		}
+
+		n = BLAKE3_BLOCK_LEN - state->block_len;
+		if (n > len)
+			n = len;
+		memcpy(state->block + state->block_len, p, n);
+		state->block_len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+static void blake3_digest(const struct blake3_state *state, unsigned char *digest) {
+	uint32_t cv[8], m[16], out[16];
+	uint32_t flags;
+	uint64_t counter = state->chunk;
+	uint32_t len = state->block_len;
+	unsigned int i;
+
+	// The last block of the last chunk, then the parents up to the root
+	memcpy(cv, state->cv, sizeof(cv));
+	memset(m, 0, sizeof(m));
+	for (i = 0; i < len; i++)
+		m[i / 4] |= (uint32_t)state->block[i] << (8 * (i % 4));
+	flags = BLAKE3_CHUNK_END | (state->blocks ? 0 : BLAKE3_CHUNK_START);
+	for (i = state->depth; i > 0; i--) {
+		blake3_compress(cv, m, counter, len, flags, out);
+		memcpy(m, state->stack[i - 1], 8 * sizeof(*m));
+		memcpy(m + 8, out, 8 * sizeof(*m));
+		memcpy(cv, blake3_iv, sizeof(cv));
+		counter = 0;
+		len = BLAKE3_BLOCK_LEN;
+		flags = BLAKE3_PARENT;
+	}
+	blake3_compress(cv, m, counter, len, flags | BLAKE3_ROOT, out);
+
+	for (i = 0; i < BLAKE3_OUT_LEN; i++)
+		digest[i] = out[i / 4] >> (8 * (i % 4));
+}
+
+#endif
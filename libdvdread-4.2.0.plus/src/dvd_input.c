@@ -19,12 +19,32 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE /* O_DIRECT */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "config.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H)
+/* io_uring through its system calls, no liburing needed */
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#define DVDINPUT_URING 1
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "dvdread/dvd_reader.h"
 #include "dvd_input.h"
 
@@ -36,6 +56,17 @@ int         (*dvdinput_seek)  (dvd_input_t, int)              = NULL;
 int         (*dvdinput_title) (dvd_input_t, int)              = NULL;
 int         (*dvdinput_read)  (dvd_input_t, void *, int, int) = NULL;
 char *      (*dvdinput_error) (dvd_input_t)                   = NULL;
+int         (*dvdinput_readv) (dvd_input_t, dvdinput_batch_t *, int, int) = NULL;
+const unsigned char *(*dvdinput_map) (dvd_input_t, uint32_t, int) = NULL;
+ssize_t     (*dvdinput_copy)  (dvd_input_t, uint32_t, size_t, int) = NULL;
+dvdinput_queue_t (*dvdinput_queue_open) (dvd_input_t, int)   = NULL;
+void        (*dvdinput_acquire) (dvd_input_t)                 = NULL;
+void        (*dvdinput_release) (dvd_input_t)                 = NULL;
+
+/* Serialises setup so concurrent DVDOpen() calls fill the pointers once,
+ * and remembers whether that setup found libdvdcss. */
+static pthread_mutex_t dvdinput_lock = PTHREAD_MUTEX_INITIALIZER;
+static int dvdinput_have_css = 0;
 
 #ifdef HAVE_DVDCSS_DVDCSS_H
 /* linking to libdvdcss */
@@ -70,10 +101,81 @@ struct dvd_input_s {
   /* libdvdcss handle */
   dvdcss_handle dvdcss;
 
+  /* Held across a seek + read, or a title switch + read, see
+   * dvdinput_acquire().  Recursive, so a holder can go on reading. */
+  pthread_mutex_t lock;
+
   /* dummy file input */
   int fd;
+  off_t pos; /* Where file_read() reads next, set by file_seek() */
+  const unsigned char *map; /* Whole image when it is a mappable file */
+  off_t map_len;
+
+  /* O_DIRECT file input: fd bypasses the page cache, buffered_fd is for
+   * when the kernel turns a direct read down. */
+  int direct;
+  int buffered_fd;
+  pthread_mutex_t bounce_lock;
+  void *bounce[4];          /* Spare bounce buffers */
+  int bounce_count;
 };
 
+/* Alignment of O_DIRECT buffers, offsets and lengths, and the size of the
+ * bounce buffers reads that are not aligned go through. */
+#define DVDINPUT_DIRECT_ALIGN 4096
+#define DVDINPUT_BOUNCE_LEN   (256 * 1024)
+
+/* Copies from a mapped image of at least this many blocks are announced to
+ * the kernel first, so it reads them ahead in one go. */
+#define DVDINPUT_MAP_AHEAD 16
+
+
+/**
+ * set up the lock of a new input.
+ */
+static void dvdinput_lock_init(pthread_mutex_t *lock)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * hold and let go of the inputs opened here.
+ */
+static void dvdinput_acquire_own(dvd_input_t dev)
+{
+  pthread_mutex_lock(&dev->lock);
+}
+
+static void dvdinput_release_own(dvd_input_t dev)
+{
+  pthread_mutex_unlock(&dev->lock);
+}
+
+/* Inputs of dvdinput_setup_ext() are laid out by the caller, so they all
+ * share this lock instead of having one each. */
+static pthread_mutex_t dvdinput_ext_lock;
+static pthread_once_t dvdinput_ext_once = PTHREAD_ONCE_INIT;
+
+static void dvdinput_ext_lock_init(void)
+{
+  dvdinput_lock_init(&dvdinput_ext_lock);
+}
+
+static void dvdinput_acquire_ext(dvd_input_t dev)
+{
+  pthread_mutex_lock(&dvdinput_ext_lock);
+}
+
+static void dvdinput_release_ext(dvd_input_t dev)
+{
+  pthread_mutex_unlock(&dvdinput_ext_lock);
+}
+
 
 /**
  * initialize and open a DVD device or file.
@@ -96,6 +198,7 @@ static dvd_input_t css_open(const char *target)
     free(dev);
     return NULL;
   }
+  dvdinput_lock_init(&dev->lock);
 
   return dev;
 }
@@ -145,6 +248,7 @@ static int css_close(dvd_input_t dev)
   if(ret < 0)
     return ret;
 
+  pthread_mutex_destroy(&dev->lock);
   free(dev);
 
   return 0;
@@ -175,10 +279,191 @@ static dvd_input_t file_open(const char *target)
     free(dev);
     return NULL;
   }
+  dev->pos = 0;
+  dev->map = NULL;
+  dev->map_len = 0;
+  dev->direct = 0;
+  dev->buffered_fd = -1;
+  dvdinput_lock_init(&dev->lock);
 
   return dev;
 }
 
+/**
+ * map a file opened by file_open() whole.  Devices, and images too large for
+ * the address space, are left to pread().
+ */
+static void file_map_whole(dvd_input_t dev)
+{
+#ifdef HAVE_SYS_MMAN_H
+  struct stat st;
+  void *map;
+
+  if(fstat(dev->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+     (uint64_t)st.st_size <= SIZE_MAX) {
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, dev->fd, 0);
+    if(map != MAP_FAILED) {
+      dev->map = map;
+      dev->map_len = st.st_size;
+    }
+  }
+#endif
+}
+
+#ifdef O_DIRECT
+/**
+ * open a file or device for reads that bypass the page cache.  Falls back
+ * to file_open() where O_DIRECT is not supported.
+ */
+static dvd_input_t file_open_direct(const char *target)
+{
+  dvd_input_t dev;
+
+  dev = (dvd_input_t) malloc(sizeof(*dev));
+  if(dev == NULL) {
+    fprintf(stderr, "libdvdread: Could not allocate memory.\n");
+    return NULL;
+  }
+
+  dev->fd = open(target, O_RDONLY | O_DIRECT);
+  if(dev->fd < 0) {
+    free(dev);
+    return file_open(target);
+  }
+  dev->buffered_fd = open(target, O_RDONLY);
+  if(dev->buffered_fd < 0) {
+    perror("libdvdread: Could not open input");
+    close(dev->fd);
+    free(dev);
+    return NULL;
+  }
+  dev->pos = 0;
+  dev->map = NULL;
+  dev->map_len = 0;
+  dev->direct = 1;
+  dev->bounce_count = 0;
+  dvdinput_lock_init(&dev->lock);
+  pthread_mutex_init(&dev->bounce_lock, NULL);
+
+  return dev;
+}
+
+static void *bounce_get(dvd_input_t dev)
+{
+  void *buffer = NULL;
+
+  pthread_mutex_lock(&dev->bounce_lock);
+  if(dev->bounce_count > 0)
+    buffer = dev->bounce[--dev->bounce_count];
+  pthread_mutex_unlock(&dev->bounce_lock);
+
+  if(buffer == NULL &&
+     posix_memalign(&buffer, DVDINPUT_DIRECT_ALIGN, DVDINPUT_BOUNCE_LEN) != 0)
+    return NULL;
+  return buffer;
+}
+
+static void bounce_put(dvd_input_t dev, void *buffer)
+{
+  pthread_mutex_lock(&dev->bounce_lock);
+  if(dev->bounce_count < (int)(sizeof(dev->bounce) / sizeof(dev->bounce[0]))) {
+    dev->bounce[dev->bounce_count++] = buffer;
+    buffer = NULL;
+  }
+  pthread_mutex_unlock(&dev->bounce_lock);
+  free(buffer);
+}
+
+/**
+ * pread() len bytes at pos from a direct input.  Aligned reads go straight
+ * into the caller's buffer, the rest through a bounce buffer.  Returns the
+ * bytes read, fewer than len only at the end of the file, or -1 on failure.
+ */
+static ssize_t file_pread_direct(dvd_input_t dev, void *buffer, size_t len,
+                                 off_t pos)
+{
+  size_t bytes = 0, aligned, skip, want;
+  unsigned char *bounce = NULL;
+  off_t start;
+  ssize_t ret;
+
+  if((uintptr_t)buffer % DVDINPUT_DIRECT_ALIGN == 0 &&
+     pos % DVDINPUT_DIRECT_ALIGN == 0) {
+    aligned = len & ~(size_t)(DVDINPUT_DIRECT_ALIGN - 1);
+    while(bytes < aligned) {
+      ret = pread(dev->fd, (char *)buffer + bytes, aligned - bytes,
+                  pos + (off_t)bytes);
+      if(ret < 0)
+        goto buffered;
+      if(ret == 0)
+        return bytes;
+      bytes += ret;
+      if(ret % DVDINPUT_DIRECT_ALIGN)
+        return bytes; /* The end of the file */
+    }
+  }
+
+  while(bytes < len) {
+    if(bounce == NULL && (bounce = bounce_get(dev)) == NULL)
+      goto buffered;
+
+    start = (pos + (off_t)bytes) & ~(off_t)(DVDINPUT_DIRECT_ALIGN - 1);
+    skip = (size_t)(pos + (off_t)bytes - start);
+    want = (skip + len - bytes + DVDINPUT_DIRECT_ALIGN - 1)
+      & ~(size_t)(DVDINPUT_DIRECT_ALIGN - 1);
+    if(want > DVDINPUT_BOUNCE_LEN)
+      want = DVDINPUT_BOUNCE_LEN;
+
+    ret = pread(dev->fd, bounce, want, start);
+    if(ret < 0)
+      goto buffered;
+    if((size_t)ret <= skip)
+      break; /* The end of the file */
+    ret -= skip;
+    if((size_t)ret > len - bytes)
+      ret = len - bytes;
+    memcpy((char *)buffer + bytes, bounce + skip, ret);
+    bytes += ret;
+  }
+
+  if(bounce)
+    bounce_put(dev, bounce);
+  return bytes;
+
+ buffered:
+  /* Not for O_DIRECT after all (or no memory), read the rest normally */
+  if(bounce)
+    bounce_put(dev, bounce);
+  while(bytes < len) {
+    ret = pread(dev->buffered_fd, (char *)buffer + bytes, len - bytes,
+                pos + (off_t)bytes);
+    if(ret < 0)
+      return bytes ? (ssize_t)bytes : ret;
+    if(ret == 0)
+      break;
+    bytes += ret;
+  }
+  return bytes;
+}
+#endif
+
+/**
+ * open a file with the given DVDINPUT_OPEN_* flags.
+ */
+dvd_input_t dvdinput_open_flags(const char *target, int flags)
+{
+  dvd_input_t dev;
+
+#ifdef O_DIRECT
+  if((flags & DVDINPUT_OPEN_DIRECT) && dvdinput_open == file_open)
+    return file_open_direct(target);
+#endif
+  dev = dvdinput_open(target);
+  if(dev && (flags & DVDINPUT_OPEN_MAP) && dvdinput_open == file_open)
+    file_map_whole(dev);
+  return dev;
+}
+
 /**
  * return the last error message
  */
@@ -209,18 +494,10 @@ static int file_seek(dvd_input_t dev, unsigned int blocks)
   return 1;
 }
 #else // Not windows
+/* Reads carry their own offset, so seeking only records where to read. */
 static int file_seek(dvd_input_t dev, unsigned int blocks)
 {
-  off_t pos;
-
-  pos = lseek(dev->fd, (off_t)blocks * (off_t)DVD_VIDEO_LB_LEN, SEEK_SET);
-  if(pos < 0) {
-#ifdef DEBUG
-    fprintf(stderr, "Failed to seek to %u: %u\r\n", blocks, pos);
-#endif
-    return pos;
-  }
-  /* assert pos % DVD_VIDEO_LB_LEN == 0 */
+  dev->pos = (off_t)blocks * (off_t)DVD_VIDEO_LB_LEN;
   return 1;
 }
 #endif
@@ -233,6 +510,7 @@ static int file_title(dvd_input_t dev, int block)
   return -1;
 }
 
+#ifdef WIN32
 /**
  * read data from the device.
  */
@@ -269,6 +547,163 @@ static int file_read(dvd_input_t dev, void *buffer, int blocks, int flags)
 
   return blocks;
 }
+#else // Not windows
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * tell the kernel the mapped bytes [pos, pos + len) are about to be read.
+ */
+static void file_willneed(dvd_input_t dev, off_t pos, size_t len)
+{
+  uintptr_t start = (uintptr_t)(dev->map + pos);
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+  madvise((void *)(start & ~(page - 1)), len + (start & (page - 1)),
+          MADV_WILLNEED);
+}
+#endif
+
+/**
+ * read len bytes at pos, going on after short reads.  Returns the bytes read,
+ * fewer than len only at the end of the file, or -1 on failure.
+ */
+static ssize_t file_pread(dvd_input_t dev, void *buffer, size_t len, off_t pos)
+{
+  size_t bytes = 0;
+  ssize_t ret;
+
+#ifdef O_DIRECT
+  if(dev->direct)
+    return file_pread_direct(dev, buffer, len, pos);
+#endif
+
+  if(dev->map) {
+    if(pos >= dev->map_len)
+      return 0;
+    if((off_t)len > dev->map_len - pos)
+      len = (size_t)(dev->map_len - pos);
+#ifdef HAVE_SYS_MMAN_H
+    if(len >= DVDINPUT_MAP_AHEAD * DVD_VIDEO_LB_LEN)
+      file_willneed(dev, pos, len);
+#endif
+    memcpy(buffer, dev->map + pos, len);
+    return len;
+  }
+
+  while(bytes < len) {
+    ret = pread(dev->fd, (char *)buffer + bytes, len - bytes, pos + (off_t)bytes);
+    if(ret < 0)
+      return ret;
+    if(ret == 0)
+      break;
+    bytes += ret;
+  }
+
+  return bytes;
+}
+
+/**
+ * read data from the device, at the block given to file_seek().
+ */
+static int file_read(dvd_input_t dev, void *buffer, int blocks, int flags)
+{
+  ssize_t ret;
+
+  ret = file_pread(dev, buffer, (size_t)blocks * DVD_VIDEO_LB_LEN, dev->pos);
+  if(ret < 0)
+    return ret;
+
+  /* Only whole blocks are returned, and the position stays on a block
+   * boundary. */
+  dev->pos += ret - ret % DVD_VIDEO_LB_LEN;
+  return (int)(ret / DVD_VIDEO_LB_LEN);
+}
+
+/**
+ * read a batch of requests, one positioned read per request.  Shares no
+ * state with other readers of dev, so any number of threads may call it.
+ */
+static int file_readv(dvd_input_t dev, dvdinput_batch_t *batch, int count,
+                      int flags)
+{
+  int i, total = 0;
+  size_t len;
+  ssize_t ret;
+
+  for(i = 0; i < count; i++) {
+    len = (size_t)batch[i].blocks * DVD_VIDEO_LB_LEN;
+    ret = file_pread(dev, batch[i].buffer, len,
+                     (off_t)batch[i].lb * (off_t)DVD_VIDEO_LB_LEN);
+    if(ret < 0)
+      return total ? total : (int)ret;
+
+    /* Only whole blocks count, as in file_read() */
+    total += (int)(ret / DVD_VIDEO_LB_LEN);
+    if((size_t)ret < len)
+      break;
+  }
+
+  return total;
+}
+#endif
+
+/**
+ * address of blocks in the mapped image, without copying them.
+ */
+static const unsigned char *file_map(dvd_input_t dev, uint32_t lb, int blocks)
+{
+  off_t pos = (off_t)lb * (off_t)DVD_VIDEO_LB_LEN;
+  size_t len = (size_t)blocks * DVD_VIDEO_LB_LEN;
+
+  if(!dev->map || blocks <= 0 || pos >= dev->map_len ||
+     (off_t)len > dev->map_len - pos)
+    return NULL;
+
+#ifdef HAVE_SYS_MMAN_H
+  if(blocks > 1)
+    file_willneed(dev, pos, len);
+#endif
+  return dev->map + pos;
+}
+
+/**
+ * copy len bytes from block lb to out_fd without passing them through user
+ * space: copy_file_range() when out_fd is a file, sendfile() when that is
+ * refused, e.g. for pipes and sockets.  Returns the bytes copied, fewer than
+ * len at the end of the image or when a copy fails midway, or -1 when
+ * neither works between these descriptors.
+ */
+static ssize_t file_copy(dvd_input_t dev, uint32_t lb, size_t len, int out_fd)
+{
+  /* Copies go through the page cache, not around it. */
+  int fd = dev->direct ? dev->buffered_fd : dev->fd;
+  off_t pos = (off_t)lb * (off_t)DVD_VIDEO_LB_LEN;
+  size_t bytes = 0;
+  ssize_t ret = -1;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while(bytes < len) {
+    ret = copy_file_range(fd, &pos, out_fd, NULL, len - bytes, 0);
+    if(ret <= 0)
+      break;
+    bytes += ret;
+  }
+  if(bytes > 0 || ret == 0)
+    return bytes;
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+  while(bytes < len) {
+    ret = sendfile(out_fd, fd, &pos, len - bytes);
+    if(ret <= 0)
+      break;
+    bytes += ret;
+  }
+#endif
+
+  if(bytes == 0 && ret < 0)
+    return -1;
+  return bytes;
+}
 
 /**
  * close the DVD device and clean up.
@@ -277,31 +712,458 @@ static int file_close(dvd_input_t dev)
 {
   int ret;
 
+#ifdef HAVE_SYS_MMAN_H
+  if(dev->map)
+    munmap((void *)dev->map, (size_t)dev->map_len);
+#endif
+  if(dev->direct) {
+    while(dev->bounce_count > 0)
+      free(dev->bounce[--dev->bounce_count]);
+    pthread_mutex_destroy(&dev->bounce_lock);
+    close(dev->buffered_fd);
+  }
+
   ret = close(dev->fd);
 
   if(ret < 0)
     return ret;
 
+  pthread_mutex_destroy(&dev->lock);
   free(dev);
 
   return 0;
 }
 
 
+/**
+ * for backends that do not map the image.
+ */
+static const unsigned char *dvdinput_map_none(dvd_input_t dev, uint32_t lb,
+                                              int blocks)
+{
+  return NULL;
+}
+
+/**
+ * for backends that can't hand their data to the kernel.
+ */
+static ssize_t dvdinput_copy_none(dvd_input_t dev, uint32_t lb, size_t len,
+                                  int out_fd)
+{
+  return -1;
+}
+
+/**
+ * read a batch of requests through dvdinput_seek() and dvdinput_read(), for
+ * backends that have nothing better.
+ */
+static int dvdinput_readv_seq(dvd_input_t dev, dvdinput_batch_t *batch,
+                              int count, int flags)
+{
+  int i, ret = 0, total = 0;
+
+  /* Another thread of the same input must not seek in between */
+  dvdinput_acquire(dev);
+  for(i = 0; i < count; i++) {
+    if(dvdinput_seek(dev, (int)batch[i].lb) < 0) {
+      ret = -1;
+      break;
+    }
+
+    ret = dvdinput_read(dev, batch[i].buffer, batch[i].blocks, flags);
+    if(ret < 0)
+      break;
+
+    total += ret;
+    if(ret < batch[i].blocks)
+      break;
+  }
+  dvdinput_release(dev);
+
+  if(ret < 0 && !total)
+    return ret;
+  return total;
+}
+
+/* Read queues.  Each holds up to depth requests between submit and reap.
+ * Without an io_uring, requests are read on submit and wait in 'done'. */
+struct dvdinput_queue_s {
+  dvd_input_t dev;
+  int depth;
+  int pending;              /* Submitted and not yet reaped */
+  dvdinput_batch_t **done;  /* Ring of completed requests */
+  int done_head, done_count;
+
+#ifdef DVDINPUT_URING
+  int ring_fd;              /* -1 when reads complete on submit */
+  int inflight;             /* Taken by the kernel and not yet reaped */
+  struct dvdinput_queue_slot {
+    dvdinput_batch_t *req;
+    size_t bytes;           /* Read so far, for resubmitting short reads */
+    struct iovec iov;
+  } *slots;
+  int *free_slots, free_count;
+
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+static void queue_done(dvdinput_queue_t q, dvdinput_batch_t *req)
+{
+  q->done[(q->done_head + q->done_count) % q->depth] = req;
+  q->done_count++;
+}
+
+/**
+ * open a queue whose requests are read with dvdinput_readv() on submit.
+ */
+static dvdinput_queue_t queue_open_seq(dvd_input_t dev, int depth)
+{
+  dvdinput_queue_t q;
+
+  if(depth <= 0)
+    return NULL;
+
+  q = calloc(1, sizeof(*q));
+  if(q == NULL)
+    return NULL;
+  q->done = malloc(depth * sizeof(*q->done));
+  if(q->done == NULL) {
+    free(q);
+    return NULL;
+  }
+  q->dev = dev;
+  q->depth = depth;
+#ifdef DVDINPUT_URING
+  q->ring_fd = -1;
+#endif
+
+  return q;
+}
+
+#ifdef DVDINPUT_URING
+static int uring_enter(dvdinput_queue_t q, unsigned submit, unsigned complete,
+                       unsigned flags)
+{
+  int ret;
+
+  do {
+    ret = syscall(__NR_io_uring_enter, q->ring_fd, submit, complete, flags,
+                  NULL, 0);
+  } while(ret < 0 && errno == EINTR);
+
+  return ret;
+}
+
+/**
+ * put the (rest of the) read of a slot in the submission ring.
+ */
+static void uring_prep(dvdinput_queue_t q, int s)
+{
+  struct dvdinput_queue_slot *slot = &q->slots[s];
+  unsigned tail = *q->sq_tail;
+  unsigned index = tail & *q->sq_mask;
+  struct io_uring_sqe *sqe = &q->sqes[index];
+  size_t len = (size_t)slot->req->blocks * DVD_VIDEO_LB_LEN;
+
+  slot->iov.iov_base = (char *)slot->req->buffer + slot->bytes;
+  slot->iov.iov_len = len - slot->bytes;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = q->dev->fd;
+  sqe->off = (uint64_t)slot->req->lb * DVD_VIDEO_LB_LEN + slot->bytes;
+  sqe->addr = (uintptr_t)&slot->iov;
+  sqe->len = 1;
+  sqe->user_data = s;
+
+  q->sq_array[index] = index;
+  __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * hand the prepared reads to the kernel.  Those it refuses are read here
+ * and completed at once.
+ */
+static void uring_submit(dvdinput_queue_t q, unsigned count)
+{
+  unsigned head;
+  int ret, s;
+
+  while(count > 0) {
+    ret = uring_enter(q, count, 0, 0);
+    if(ret > 0) {
+      count -= ret;
+      q->inflight += ret;
+      continue;
+    }
+    if(ret < 0 && (errno == EAGAIN || errno == EBUSY) && q->inflight > 0) {
+      /* Out of kernel resources for now; let some reads finish. */
+      uring_enter(q, 0, 1, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    /* Nothing in flight to wait for: read the rest below */
+    break;
+  }
+
+  /* Take back what the kernel did not consume */
+  head = __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE);
+  while(*q->sq_tail != head) {
+    unsigned tail = *q->sq_tail - 1;
+
+    s = (int)q->sqes[q->sq_array[tail & *q->sq_mask]].user_data;
+    *q->sq_tail = tail;
+    q->slots[s].req->result = file_readv(q->dev, q->slots[s].req, 1, 0);
+    queue_done(q, q->slots[s].req);
+    q->free_slots[q->free_count++] = s;
+  }
+}
+
+static void uring_close(dvdinput_queue_t q)
+{
+  if(q->sqes)
+    munmap(q->sqes, q->sqes_len);
+  if(q->cq_ring && q->cq_ring != q->sq_ring)
+    munmap(q->cq_ring, q->cq_ring_len);
+  if(q->sq_ring)
+    munmap(q->sq_ring, q->sq_ring_len);
+  if(q->ring_fd >= 0)
+    close(q->ring_fd);
+  free(q->slots);
+  free(q->free_slots);
+  q->ring_fd = -1;
+  q->sq_ring = q->cq_ring = NULL;
+  q->sqes = NULL;
+  q->slots = NULL;
+  q->free_slots = NULL;
+}
+
+/**
+ * open a queue for the file input, backed by an io_uring when the kernel
+ * has one to give.
+ */
+static dvdinput_queue_t file_queue_open(dvd_input_t dev, int depth)
+{
+  struct io_uring_params p;
+  dvdinput_queue_t q;
+  char *sq, *cq;
+  int i;
+
+  q = queue_open_seq(dev, depth);
+  if(q == NULL)
+    return NULL;
+
+  memset(&p, 0, sizeof(p));
+  q->ring_fd = syscall(__NR_io_uring_setup, (unsigned)depth, &p);
+  if(q->ring_fd < 0) {
+    q->ring_fd = -1;
+    return q;
+  }
+
+  q->slots = malloc(depth * sizeof(*q->slots));
+  q->free_slots = malloc(depth * sizeof(*q->free_slots));
+  if(!q->slots || !q->free_slots)
+    goto fail;
+  for(i = 0; i < depth; i++)
+    q->free_slots[i] = depth - 1 - i;
+  q->free_count = depth;
+
+  q->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  q->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    if(q->cq_ring_len > q->sq_ring_len)
+      q->sq_ring_len = q->cq_ring_len;
+    q->cq_ring_len = q->sq_ring_len;
+  }
+
+  q->sq_ring = mmap(NULL, q->sq_ring_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_SQ_RING);
+  if(q->sq_ring == MAP_FAILED) {
+    q->sq_ring = NULL;
+    goto fail;
+  }
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    q->cq_ring = q->sq_ring;
+  } else {
+    q->cq_ring = mmap(NULL, q->cq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_CQ_RING);
+    if(q->cq_ring == MAP_FAILED) {
+      q->cq_ring = NULL;
+      goto fail;
+    }
+  }
+  q->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  q->sqes = mmap(NULL, q->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_SQES);
+  if(q->sqes == MAP_FAILED) {
+    q->sqes = NULL;
+    goto fail;
+  }
+
+  sq = q->sq_ring;
+  cq = q->cq_ring;
+  q->sq_head  = (unsigned *)(sq + p.sq_off.head);
+  q->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+  q->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+  q->sq_array = (unsigned *)(sq + p.sq_off.array);
+  q->cq_head  = (unsigned *)(cq + p.cq_off.head);
+  q->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+  q->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+  q->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return q;
+
+ fail:
+  /* Still usable, reading on submit */
+  uring_close(q);
+  return q;
+}
+#endif
+
+int dvdinput_queue_submit(dvdinput_queue_t q, dvdinput_batch_t **reqs,
+                          int count, int flags)
+{
+  int i;
+
+  if(count <= 0 || q->pending + count > q->depth)
+    return -1;
+  q->pending += count;
+
+#ifdef DVDINPUT_URING
+  if(q->ring_fd >= 0) {
+    unsigned prepared = 0;
+
+    for(i = 0; i < count; i++) {
+      int s;
+
+      /* O_DIRECT reads the ring can't do; file_pread() bounces them */
+      if(q->dev->direct &&
+         ((uintptr_t)reqs[i]->buffer % DVDINPUT_DIRECT_ALIGN ||
+          ((off_t)reqs[i]->lb * DVD_VIDEO_LB_LEN) % DVDINPUT_DIRECT_ALIGN ||
+          ((size_t)reqs[i]->blocks * DVD_VIDEO_LB_LEN) % DVDINPUT_DIRECT_ALIGN)) {
+        reqs[i]->result = file_readv(q->dev, reqs[i], 1, flags);
+        queue_done(q, reqs[i]);
+        continue;
+      }
+
+      s = q->free_slots[--q->free_count];
+      q->slots[s].req = reqs[i];
+      q->slots[s].bytes = 0;
+      uring_prep(q, s);
+      prepared++;
+    }
+    if(prepared)
+      uring_submit(q, prepared);
+    return 0;
+  }
+#endif
+
+  for(i = 0; i < count; i++) {
+    reqs[i]->result = dvdinput_readv(q->dev, reqs[i], 1, flags);
+    queue_done(q, reqs[i]);
+  }
+
+  return 0;
+}
+
+dvdinput_batch_t *dvdinput_queue_reap(dvdinput_queue_t q, int wait)
+{
+  dvdinput_batch_t *req;
+
+  while(q->pending > 0) {
+    if(q->done_count > 0) {
+      req = q->done[q->done_head];
+      q->done_head = (q->done_head + 1) % q->depth;
+      q->done_count--;
+      q->pending--;
+      return req;
+    }
+
+#ifdef DVDINPUT_URING
+    if(q->ring_fd >= 0) {
+      unsigned head = *q->cq_head;
+      struct dvdinput_queue_slot *slot;
+      size_t len;
+      int s, res;
+
+      if(head == __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE)) {
+        if(!wait)
+          return NULL;
+        uring_enter(q, 0, 1, IORING_ENTER_GETEVENTS);
+        continue;
+      }
+
+      s = (int)q->cqes[head & *q->cq_mask].user_data;
+      res = q->cqes[head & *q->cq_mask].res;
+      __atomic_store_n(q->cq_head, head + 1, __ATOMIC_RELEASE);
+      q->inflight--;
+
+      slot = &q->slots[s];
+      len = (size_t)slot->req->blocks * DVD_VIDEO_LB_LEN;
+      if(res > 0) {
+        slot->bytes += res;
+        if(slot->bytes < len) {
+          /* Short read: go on from there, it ends at end of file */
+          uring_prep(q, s);
+          uring_submit(q, 1);
+          continue;
+        }
+      }
+
+      /* Only whole blocks count, as in file_read() */
+      if(res == -EINVAL && q->dev->direct)
+        slot->req->result = file_readv(q->dev, slot->req, 1, 0);
+      else if(res < 0 && slot->bytes == 0)
+        slot->req->result = res;
+      else
+        slot->req->result = (int)(slot->bytes / DVD_VIDEO_LB_LEN);
+      q->free_slots[q->free_count++] = s;
+      queue_done(q, slot->req);
+      continue;
+    }
+#endif
+    break;
+  }
+
+  return NULL;
+}
+
+void dvdinput_queue_close(dvdinput_queue_t q)
+{
+  if(q == NULL)
+    return;
+
+  while(dvdinput_queue_reap(q, 1) != NULL)
+    ;
+#ifdef DVDINPUT_URING
+  uring_close(q);
+#endif
+  free(q->done);
+  free(q);
+}
+
 /**
  * Setup read functions with either libdvdcss or minimal DVD access.
+ * Must be called with dvdinput_lock held.
  */
-int dvdinput_setup(void)
+static int dvdinput_setup_locked(void)
 {
   void *dvdcss_library = NULL;
   char **dvdcss_version = NULL;
 
   /*
-   * If dvdinput_setup_ext() has already been called with functions to use
-   * then we are already done. */
+   * If dvdinput_setup() or dvdinput_setup_ext() has already been called
+   * with functions to use then we are already done. */
   if (dvdinput_open && dvdinput_close && dvdinput_seek &&
-      dvdinput_title && dvdinput_read && dvdinput_error )
-      return 0;
+      dvdinput_title && dvdinput_read && dvdinput_error && dvdinput_readv &&
+      dvdinput_map && dvdinput_queue_open && dvdinput_acquire)
+      return dvdinput_have_css;
 
 
 #ifdef HAVE_DVDCSS_DVDCSS_H
@@ -378,6 +1240,13 @@ int dvdinput_setup(void)
     dvdinput_title = css_title;
     dvdinput_read  = css_read;
     dvdinput_error = css_error;
+    dvdinput_readv = dvdinput_readv_seq;
+    dvdinput_map   = dvdinput_map_none;
+    dvdinput_queue_open = queue_open_seq;
+    dvdinput_copy  = dvdinput_copy_none;
+    dvdinput_acquire = dvdinput_acquire_own;
+    dvdinput_release = dvdinput_release_own;
+    dvdinput_have_css = 1;
     return 1;
 
   } else {
@@ -390,10 +1259,36 @@ int dvdinput_setup(void)
     dvdinput_title = file_title;
     dvdinput_read  = file_read;
     dvdinput_error = file_error;
+#ifndef WIN32
+    dvdinput_readv = file_readv;
+#else
+    dvdinput_readv = dvdinput_readv_seq;
+#endif
+    dvdinput_map   = file_map;
+#ifdef DVDINPUT_URING
+    dvdinput_queue_open = file_queue_open;
+#else
+    dvdinput_queue_open = queue_open_seq;
+#endif
+    dvdinput_copy  = file_copy;
+    dvdinput_acquire = dvdinput_acquire_own;
+    dvdinput_release = dvdinput_release_own;
+    dvdinput_have_css = 0;
     return 0;
   }
 }
 
+int dvdinput_setup(void)
+{
+  int ret;
+
+  pthread_mutex_lock(&dvdinput_lock);
+  ret = dvdinput_setup_locked();
+  pthread_mutex_unlock(&dvdinput_lock);
+
+  return ret;
+}
+
 
 int dvdinput_setup_ext(
                        dvd_input_t (*dvdi_open)  (const char *),
@@ -404,6 +1299,9 @@ int dvdinput_setup_ext(
                        char *      (*dvdi_error) (dvd_input_t)
                        )
 {
+    int ret;
+
+    pthread_mutex_lock(&dvdinput_lock);
 
     /* If NULL is passed, we want to reset the IO handlers back to standard.
      */
@@ -415,8 +1313,16 @@ int dvdinput_setup_ext(
         dvdinput_title = NULL;
         dvdinput_read  = NULL;
         dvdinput_error = NULL;
+        dvdinput_readv = NULL;
+        dvdinput_map   = NULL;
+        dvdinput_queue_open = NULL;
+        dvdinput_copy  = NULL;
+        dvdinput_acquire = NULL;
+        dvdinput_release = NULL;
         /* Call setup to set IO functions to either file, or CSS */
-        return dvdinput_setup();
+        ret = dvdinput_setup_locked();
+        pthread_mutex_unlock(&dvdinput_lock);
+        return ret;
     }
 
     dvdinput_open  = dvdi_open;
@@ -425,5 +1331,15 @@ int dvdinput_setup_ext(
     dvdinput_title = dvdi_title;
     dvdinput_read  = dvdi_read;
     dvdinput_error = dvdi_error;
+    dvdinput_readv = dvdinput_readv_seq;
+    dvdinput_map   = dvdinput_map_none;
+    dvdinput_queue_open = queue_open_seq;
+    dvdinput_copy  = dvdinput_copy_none;
+    pthread_once(&dvdinput_ext_once, dvdinput_ext_lock_init);
+    dvdinput_acquire = dvdinput_acquire_ext;
+    dvdinput_release = dvdinput_release_ext;
+    dvdinput_have_css = 0;
+
+    pthread_mutex_unlock(&dvdinput_lock);
     return 0;
 }
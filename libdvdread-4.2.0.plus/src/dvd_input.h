@@ -29,6 +29,12 @@
 
 #define DVDINPUT_READ_DECRYPT    (1 << 0)
 
+/**
+ * dvdinput_open_flags() flags.
+ */
+#define DVDINPUT_OPEN_MAP        (1 << 0)
+#define DVDINPUT_OPEN_DIRECT     (1 << 1)
+
 
 #if defined( __MINGW32__ )
 #   undef  lseek
@@ -41,6 +47,22 @@
 #   define wstat _wstati64
 #endif
 
+/**
+ * One request of a dvdinput_readv() batch: 'blocks' blocks from block 'lb'
+ * into 'buffer'.  'result' is only used by the read queues below.
+ */
+typedef struct {
+  uint32_t lb;
+  int      blocks;
+  void    *buffer;
+  int      result;
+} dvdinput_batch_t;
+
+/**
+ * A queue of asynchronous reads on one input, see dvdinput_queue_open().
+ */
+typedef struct dvdinput_queue_s *dvdinput_queue_t;
+
 /**
  * Function pointers that will be filled in by the input implementation.
  * These functions provide the main API.
@@ -52,6 +74,76 @@ extern int         (*dvdinput_title) (dvd_input_t, int);
 extern int         (*dvdinput_read)  (dvd_input_t, void *, int, int);
 extern char *      (*dvdinput_error) (dvd_input_t);
 
+/**
+ * Reads a batch of requests, in order, with the given read flags.  Returns
+ * the number of blocks read before the first short or failed request, or a
+ * negative error if the first one failed.  Always set: backends without a
+ * batched read get a seek + read per request.
+ */
+extern int         (*dvdinput_readv) (dvd_input_t, dvdinput_batch_t *, int, int);
+
+/**
+ * Returns the address of 'blocks' blocks from block 'lb' when the input has
+ * the image mapped in memory, NULL when it has not or they are past its end.
+ * Mapped data is never decrypted, and stays valid until dvdinput_close().
+ * Asking for more than one block hints that they will be read soon.
+ */
+extern const unsigned char *(*dvdinput_map) (dvd_input_t, uint32_t, int);
+
+/**
+ * Copies 'len' bytes from block 'lb' to the file descriptor given last,
+ * inside the kernel.  Returns the bytes copied, fewer than len at the end of
+ * the image or when the copy fails midway, or -1 when nothing could be
+ * copied because the input or the descriptor doesn't allow it.  Data is
+ * never decrypted.
+ */
+extern ssize_t     (*dvdinput_copy)  (dvd_input_t, uint32_t, size_t, int);
+
+/**
+ * Opens a queue keeping up to 'depth' requests in flight on the input, or
+ * returns NULL.  Inputs that can't read asynchronously get a queue that
+ * completes each request when it is submitted.
+ */
+extern dvdinput_queue_t (*dvdinput_queue_open) (dvd_input_t, int);
+
+/**
+ * Hold the input for a sequence of calls that must not be interleaved with
+ * those of other threads, such as a title switch and the reads under its
+ * key, and let go of it.  Holds nest; dvdinput_readv() takes one itself
+ * around its seek + read pairs.  Inputs of this library each have their
+ * own; those of dvdinput_setup_ext() share one.
+ */
+extern void        (*dvdinput_acquire) (dvd_input_t);
+extern void        (*dvdinput_release) (dvd_input_t);
+
+/**
+ * Queues 'count' requests, all of them or, when that would exceed the depth,
+ * none.  Returns 0, or -1 if they were not queued.  The requests and their
+ * buffers must stay untouched until they are returned by the reaping call.
+ */
+int dvdinput_queue_submit(dvdinput_queue_t, dvdinput_batch_t **, int, int);
+
+/**
+ * Returns a completed request, in no particular order, with 'result' set to
+ * the blocks read or a negative error.  NULL when nothing is in flight, or
+ * when 'wait' is 0 and no request has completed yet.
+ */
+dvdinput_batch_t *dvdinput_queue_reap(dvdinput_queue_t, int);
+
+/**
+ * Waits for the requests still in flight and frees the queue.
+ */
+void dvdinput_queue_close(dvdinput_queue_t);
+
+/**
+ * dvdinput_open() with DVDINPUT_OPEN_* flags.  DVDINPUT_OPEN_MAP maps regular
+ * files of the plain file input whole, for dvdinput_map().
+ * DVDINPUT_OPEN_DIRECT reads files and devices past the page cache with
+ * O_DIRECT where the plain file input is in use and the system supports it,
+ * and wins over DVDINPUT_OPEN_MAP.  Both are ignored otherwise.
+ */
+dvd_input_t dvdinput_open_flags(const char *, int);
+
 /**
  * Setup function accessed by dvd_reader.c.  Returns 1 if there is CSS support.
  */
@@ -75,6 +75,13 @@ static inline int _private_gettimeofday( struct timeval *tv, void *tz )
 
 #define TITLES_MAX 9
 
+/* Extent runs handed to the input per dvdinput_readv() call */
+#define DVD_READ_BATCH 16
+
+/* Size of the DVDReadBytes() buffer; longer unaligned reads only go through
+ * it for their first and last block. */
+#define DVD_SECBUF_BLOCKS 16
+
 struct dvd_file_s {
   /* Basic information. */
   dvd_reader_t *dvd;
@@ -95,6 +102,11 @@ struct dvd_file_s {
 
   /* Size of file in bytes. */
   uint64_t filebytes;
+
+  /* DVDReadBytes() buffer for reads that don't fill whole blocks, made on
+   * first use. */
+  unsigned char *secbuf_base;
+  unsigned char *secbuf;
 };
 
 int UDFReadBlocksRaw( dvd_reader_t *device, uint32_t lb_number,
@@ -121,6 +133,22 @@ int DVDUDFCacheLevel(dvd_reader_t *device, int level)
   return level;
 }
 
+/**
+ * Set the number of blocks the udf cache holds
+ * blocks = -1 (return the current size)
+ * blocks = 0 (no cache memory, same as level 0)
+ */
+int DVDUDFCacheSize(dvd_reader_t *device, int blocks)
+{
+  struct dvd_reader_s *dev = (struct dvd_reader_s *)device;
+
+  if(blocks < 0)
+    return dev->cache_size;
+
+  UDFCacheFree(dev);
+  return UDFCacheInit(dev, blocks);
+}
+
 
 
 /* Loop over all titles and call dvdcss_title to crack the keys. */
@@ -199,13 +227,17 @@ static int initAllCSSKeys( dvd_reader_t *dvd )
 /**
  * Open a DVD image or block device file.
  */
-static dvd_reader_t *DVDOpenImageFile( const char *location, int have_css )
+static dvd_reader_t *DVDOpenImageFile( const char *location, int have_css,
+                                       int flags )
 {
   dvd_reader_t *dvd;
   dvd_input_t dev;
-  int i;
 
-  dev = dvdinput_open( location );
+  dev = dvdinput_open_flags( location,
+                             ( ( flags & DVD_OPEN_MAP ) ?
+                               DVDINPUT_OPEN_MAP : 0 ) |
+                             ( ( flags & DVD_OPEN_DIRECT ) ?
+                               DVDINPUT_OPEN_DIRECT : 0 ) );
   if( !dev ) {
     fprintf( stderr, "libdvdread: Can't open %s for reading\n", location );
     return NULL;
@@ -222,11 +254,10 @@ static dvd_reader_t *DVDOpenImageFile( const char *location, int have_css )
   dvd->path_root = NULL;
 
   dvd->udfcache_level = DEFAULT_UDF_CACHE_LEVEL;
-  dvd->cache_index = 0;
-  for (i = 0; i < NUM_UDF_CACHE; i++)
-      dvd->udf_cache[i].lbnumber = 0;
-
+  UDFCacheInit(dvd, NUM_UDF_CACHE);
+  memset(dvd->dir_index, 0, sizeof(dvd->dir_index));
 
+  dvd->css_state = 0;
   if( have_css ) {
     /* Only if DVDCSS_METHOD = title, a bit if it's disc or if
      * DVDCSS_METHOD = key but region mismatch. Unfortunately we
@@ -238,6 +269,9 @@ static dvd_reader_t *DVDOpenImageFile( const char *location, int have_css )
 
   if (!UDFOpen(dvd)) {
       dvdinput_close(dev);
+      UDFClose(dvd);
+      UDFCacheFree(dvd);
+      UDFDirIndexFree(dvd);
       free(dvd);
       return NULL;
   }
@@ -247,7 +281,6 @@ static dvd_reader_t *DVDOpenImageFile( const char *location, int have_css )
 static dvd_reader_t *DVDOpenPath( const char *path_root )
 {
   dvd_reader_t *dvd;
-  int i;
 
   dvd = (dvd_reader_t *) malloc( sizeof( dvd_reader_t ) );
   if( !dvd ) return NULL;
@@ -259,14 +292,16 @@ static dvd_reader_t *DVDOpenPath( const char *path_root )
     return 0;
   }
   dvd->udfcache_level = DEFAULT_UDF_CACHE_LEVEL;
-  dvd->cache_index = 0;
-  for (i = 0; i < NUM_UDF_CACHE; i++)
-      dvd->udf_cache[i].lbnumber = 0;
+  UDFCacheInit(dvd, NUM_UDF_CACHE);
+  memset(dvd->dir_index, 0, sizeof(dvd->dir_index));
 
   dvd->css_state = 0; /* Only used in the UDF path */
   dvd->css_title = 0; /* Only matters in the UDF path */
 
   if (!UDFOpen(dvd)) {
+      UDFClose(dvd);
+      UDFCacheFree(dvd);
+      UDFDirIndexFree(dvd);
       free(dvd);
       return NULL;
   }
@@ -326,7 +361,17 @@ static char *bsd_block2char( const char *path )
 #endif
 
 
+int DVDInit( void )
+{
+  return dvdinput_setup();
+}
+
 dvd_reader_t *DVDOpen( const char *ppath )
+{
+  return DVDOpenFlags( ppath, 0 );
+}
+
+dvd_reader_t *DVDOpenFlags( const char *ppath, int flags )
 {
   struct stat fileinfo;
   int ret, have_css, retval, cdir = -1;
@@ -365,7 +410,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
 
     /* maybe "host:port" url? try opening it with acCeSS library */
     if( strchr(path,':') ) {
-                    ret_val = DVDOpenImageFile( path, have_css );
+                    ret_val = DVDOpenImageFile( path, have_css, flags );
                     free(path);
             return ret_val;
     }
@@ -392,7 +437,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
 #else
     dev_name = strdup( path );
 #endif
-    dvd = DVDOpenImageFile( dev_name, have_css );
+    dvd = DVDOpenImageFile( dev_name, have_css, flags );
     free( dev_name );
     free(path);
     return dvd;
@@ -474,7 +519,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
                " mounted on %s for CSS authentication\n",
                dev_name,
                fe->fs_file );
-      auth_drive = DVDOpenImageFile( dev_name, have_css );
+      auth_drive = DVDOpenImageFile( dev_name, have_css, flags );
     }
 #elif defined(__sun)
     mntfile = fopen( MNTTAB, "r" );
@@ -490,7 +535,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
                    " mounted on %s for CSS authentication\n",
                    dev_name,
                    mp.mnt_mountp );
-          auth_drive = DVDOpenImageFile( dev_name, have_css );
+          auth_drive = DVDOpenImageFile( dev_name, have_css, flags );
           break;
         }
       }
@@ -508,7 +553,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
                    " mounted on %s for CSS authentication\n",
                    me->mnt_fsname,
                    me->mnt_dir );
-          auth_drive = DVDOpenImageFile( me->mnt_fsname, have_css );
+          auth_drive = DVDOpenImageFile( me->mnt_fsname, have_css, flags );
           dev_name = strdup(me->mnt_fsname);
           break;
         }
@@ -522,7 +567,7 @@ dvd_reader_t *DVDOpen( const char *ppath )
         ( !path[2] ||
           ((path[2] == '\\' || path[2] == '/') && !path[3])))
 #endif
-    auth_drive = DVDOpenImageFile( path, have_css );
+    auth_drive = DVDOpenImageFile( path, have_css, flags );
 #endif
 
 #if !defined(_WIN32) && !defined(__OS2__)
@@ -578,6 +623,9 @@ void DVDClose( dvd_reader_t *dvd )
   if( dvd ) {
     if( dvd->dev ) dvdinput_close( dvd->dev );
     if( dvd->path_root ) free( dvd->path_root );
+    UDFClose( dvd );
+    UDFCacheFree( dvd );
+    UDFDirIndexFree( dvd );
     free( dvd );
   }
 }
@@ -604,10 +652,13 @@ static dvd_file_t *DVDOpenFileUDF( dvd_reader_t *dvd, char *filename )
     return NULL;
   }
   dvd_file->dvd = dvd;
+  dvd_file->css_title = 0;
   dvd_file->udf_file = udf_file;
   dvd_file->seek_pos = 0;
   memset( dvd_file->title_sizes, 0, sizeof( dvd_file->title_sizes ) );
   memset( dvd_file->title_devs, 0, sizeof( dvd_file->title_devs ) );
+  dvd_file->secbuf_base = NULL;
+  dvd_file->secbuf = NULL;
   dvd_file->filesize = len / DVD_VIDEO_LB_LEN;
   dvd_file->filebytes = len;
 
@@ -701,10 +752,13 @@ static dvd_file_t *DVDOpenFilePath( dvd_reader_t *dvd, char *filename )
     return NULL;
   }
   dvd_file->dvd = dvd;
+  dvd_file->css_title = 0;
   dvd_file->udf_file = NULL;
   dvd_file->seek_pos = 0;
   memset( dvd_file->title_sizes, 0, sizeof( dvd_file->title_sizes ) );
   memset( dvd_file->title_devs, 0, sizeof( dvd_file->title_devs ) );
+  dvd_file->secbuf_base = NULL;
+  dvd_file->secbuf = NULL;
   dvd_file->filesize = 0;
 
   if( stat( full_path, &fileinfo ) < 0 ) {
@@ -746,6 +800,8 @@ static dvd_file_t *DVDOpenVOBUDF( dvd_reader_t *dvd, int title, int menu )
   dvd_file->seek_pos = 0;
   memset( dvd_file->title_sizes, 0, sizeof( dvd_file->title_sizes ) );
   memset( dvd_file->title_devs, 0, sizeof( dvd_file->title_devs ) );
+  dvd_file->secbuf_base = NULL;
+  dvd_file->secbuf = NULL;
   dvd_file->filesize = len / DVD_VIDEO_LB_LEN;
   dvd_file->filebytes = len;
   udf_file = NULL;
@@ -762,9 +818,16 @@ static dvd_file_t *DVDOpenVOBUDF( dvd_reader_t *dvd, int title, int menu )
     }
   }
 
-  if( dvd->css_state == 1 /* Need key init */ ) {
-    initAllCSSKeys( dvd );
-    dvd->css_state = 2;
+  /* Cracking switches the title of the shared input, readers must wait.
+   * css_state never goes back to 0, so it can be looked at unheld. */
+  if( dvd->css_state ) {
+    dvdinput_acquire( dvd->dev );
+    if( dvd->css_state == 1 /* Need key init */ ) {
+      initAllCSSKeys( dvd );
+      dvd->css_state = 2;
+      dvd->css_title = -1; /* Whatever key is set now, it is no file's */
+    }
+    dvdinput_release( dvd->dev );
   }
   /*
   if( dvdinput_title( dvd_file->dvd->dev, (int)start ) < 0 ) {
@@ -792,6 +855,8 @@ static dvd_file_t *DVDOpenVOBPath( dvd_reader_t *dvd, int title, int menu )
   dvd_file->seek_pos = 0;
   memset( dvd_file->title_sizes, 0, sizeof( dvd_file->title_sizes ) );
   memset( dvd_file->title_devs, 0, sizeof( dvd_file->title_devs ) );
+  dvd_file->secbuf_base = NULL;
+  dvd_file->secbuf = NULL;
   dvd_file->filesize = 0;
   dvd_file->filebytes = 0;
 
@@ -918,6 +983,7 @@ void DVDCloseFile( dvd_file_t *dvd_file )
 
     if( dvd_file->udf_file ) UDFFreeFile( dvd_file->dvd, dvd_file->udf_file );
 
+    free( dvd_file->secbuf_base );
     free( dvd_file );
     dvd_file = 0;
   }
@@ -1102,27 +1168,69 @@ int DVDFileStat( dvd_reader_t *dvd, int titlenum,
   return -1;
 }
 
+/* Reads a batch through dvdinput_readv(), which takes each request's block
+ * along, so concurrent readers of one input do not need to share a seek
+ * position.  Returns the blocks read before the first short request, or a
+ * negative error if nothing was read. */
+static int DVDInputReadv( dvd_input_t dev, dvdinput_batch_t *batch,
+                          int count, int encrypted )
+{
+  int ret;
+
+  ret = dvdinput_readv( dev, batch, count, encrypted );
+  if( ret < 0 )
+    fprintf( stderr, "libdvdread: Can't read from block %u\n", batch[ 0 ].lb );
+  return ret;
+}
+
+/* As DVDInputReadv() for a single request */
+static int DVDInputRead( dvd_input_t dev, uint32_t lb_number,
+                         size_t block_count, unsigned char *data,
+                         int encrypted )
+{
+  dvdinput_batch_t batch;
+
+  batch.lb = lb_number;
+  batch.blocks = (int)block_count;
+  batch.buffer = data;
+  return DVDInputReadv( dev, &batch, 1, encrypted );
+}
+
 /* Internal, but used from dvd_udf.c */
 int UDFReadBlocksRaw( dvd_reader_t *device, uint32_t lb_number,
                       size_t block_count, unsigned char *data,
                       int encrypted )
 {
-  int ret;
-
   if( !device->dev ) {
     fprintf( stderr, "libdvdread: Fatal error in block read.\n" );
     return 0;
   }
 
-  ret = dvdinput_seek( device->dev, (uint32_t) lb_number );
-  if( ret < 0 ) {
-    fprintf( stderr, "libdvdread: Can't seek to block %u\n", lb_number );
+  return DVDInputRead( device->dev, lb_number, block_count, data, encrypted );
+}
+
+/* Internal, but used from dvd_udf.c.  The blocks in place when the input
+ * maps the image, else NULL. */
+const unsigned char *UDFMapBlocksRaw( dvd_reader_t *device, uint32_t lb_number,
+                                      size_t block_count )
+{
+  if( !device->dev )
+    return NULL;
+
+  return dvdinput_map( device->dev, lb_number, (int)block_count );
+}
+
+/* As UDFReadBlocksRaw(), for a batch of requests handed to the input in one
+ * call. */
+static int UDFReadBlocksBatch( dvd_reader_t *device, dvdinput_batch_t *batch,
+                               int count, int encrypted )
+{
+  if( !device->dev ) {
+    fprintf( stderr, "libdvdread: Fatal error in block read.\n" );
     return 0;
   }
 
-  ret = dvdinput_read( device->dev, (char *) data,
-                       (int) block_count, encrypted );
-  return ret;
+  return DVDInputReadv( device->dev, batch, count, encrypted );
 }
 
 /* This is using a single input and starting from 'dvd_file->lb_start' offset.
@@ -1135,10 +1243,36 @@ static int DVDReadBlocksUDF( dvd_file_t *dvd_file, uint32_t offset,
                              size_t block_count, unsigned char *data,
                              int encrypted )
 {
+  dvdinput_batch_t batch[ DVD_READ_BATCH ];
+  uint32_t run;
+  size_t done = 0, queued;
+  int count, ret;
+
+  /* Split the request at extent boundaries, one batch entry per physically
+   * contiguous run, and hand the batch to the input in one go. */
+  while( done < block_count ) {
+    count = 0;
+    queued = done;
+    while( queued < block_count && count < DVD_READ_BATCH ) {
+      batch[ count ].lb = UDFFileBlockFileRun( dvd_file->dvd, dvd_file->udf_file,
+                                               offset + queued, &run );
+      if( run == 0 || run > block_count - queued )
+        run = block_count - queued;
+      batch[ count ].blocks = (int)run;
+      batch[ count ].buffer = data + queued * DVD_VIDEO_LB_LEN;
+      queued += run;
+      count++;
+    }
 
-  return UDFReadBlocksRaw( dvd_file->dvd,
-                           UDFFileBlockFile(dvd_file->dvd, dvd_file->udf_file, offset),
-                           block_count, data, encrypted );
+    ret = UDFReadBlocksBatch( dvd_file->dvd, batch, count, encrypted );
+    if( ret <= 0 )
+      return done ? (int)done : ret;
+    done += ret;
+    if( done < queued )
+      break;
+  }
+
+  return (int)done;
 }
 
 /* This is using possibly several inputs and starting from an offset of '0'.
@@ -1152,7 +1286,7 @@ static int DVDReadBlocksPath( dvd_file_t *dvd_file, unsigned int offset,
                               int encrypted )
 {
   int i;
-  int ret, ret2, off;
+  int ret, ret2;
 
   ret = 0;
   ret2 = 0;
@@ -1161,14 +1295,8 @@ static int DVDReadBlocksPath( dvd_file_t *dvd_file, unsigned int offset,
 
     if( offset < dvd_file->title_sizes[ i ] ) {
       if( ( offset + block_count ) <= dvd_file->title_sizes[ i ] ) {
-        off = dvdinput_seek( dvd_file->title_devs[ i ], (int)offset );
-        if( off < 0 ) {
-          fprintf( stderr, "libdvdread: Can't seek to block %d\n",
-                   offset );
-          return off < 0 ? off : 0;
-        }
-        ret = dvdinput_read( dvd_file->title_devs[ i ], data,
-                             (int)block_count, encrypted );
+        ret = DVDInputRead( dvd_file->title_devs[ i ], offset,
+                            block_count, data, encrypted );
         break;
       } else {
         size_t part1_size = dvd_file->title_sizes[ i ] - offset;
@@ -1176,14 +1304,8 @@ static int DVDReadBlocksPath( dvd_file_t *dvd_file, unsigned int offset,
          * (This is only true if you try and read >1GB at a time) */
 
         /* Read part 1 */
-        off = dvdinput_seek( dvd_file->title_devs[ i ], (int)offset );
-        if( off < 0 ) {
-          fprintf( stderr, "libdvdread: Can't seek to block %d\n",
-                   offset );
-          return off < 0 ? off : 0;
-        }
-        ret = dvdinput_read( dvd_file->title_devs[ i ], data,
-                             (int)part1_size, encrypted );
+        ret = DVDInputRead( dvd_file->title_devs[ i ], offset,
+                            part1_size, data, encrypted );
         if( ret < 0 ) return ret;
         /* FIXME: This is wrong if i is the last file in the set.
          * also error from this read will not show in ret. */
@@ -1193,17 +1315,11 @@ static int DVDReadBlocksPath( dvd_file_t *dvd_file, unsigned int offset,
           return ret;
 
         /* Read part 2 */
-        off = dvdinput_seek( dvd_file->title_devs[ i + 1 ], 0 );
-        if( off < 0 ) {
-          fprintf( stderr, "libdvdread: Can't seek to block %d\n",
-                   0 );
-          return off < 0 ? off : 0;
-        }
-        ret2 = dvdinput_read( dvd_file->title_devs[ i + 1 ],
-                              data + ( part1_size
-                                       * (int64_t)DVD_VIDEO_LB_LEN ),
-                              (int)(block_count - part1_size),
-                              encrypted );
+        ret2 = DVDInputRead( dvd_file->title_devs[ i + 1 ], 0,
+                             block_count - part1_size,
+                             data + ( part1_size
+                                      * (int64_t)DVD_VIDEO_LB_LEN ),
+                             encrypted );
         if( ret2 < 0 ) return ret2;
         break;
       }
@@ -1219,14 +1335,21 @@ static int DVDReadBlocksPath( dvd_file_t *dvd_file, unsigned int offset,
 ssize_t DVDReadBlocks( dvd_file_t *dvd_file, int offset,
                        size_t block_count, unsigned char *data )
 {
-  int ret;
+  int ret, hold;
 
   /* Check arguments. */
   if( dvd_file == NULL || offset < 0 || data == NULL )
     return -1;
 
-  /* Hack, and it will still fail for multiple opens in a threaded app ! */
-  if( dvd_file->dvd->css_title != dvd_file->css_title ) {
+  /* The title key is state of the shared input: hold it from the switch
+   * until the blocks are read under that key, so that files of other title
+   * sets read from other threads can't switch it in between.  Without css
+   * there are no title keys, and no shared state. */
+  hold = dvd_file->dvd->css_state && dvd_file->dvd->isImageFile;
+  if( hold )
+    dvdinput_acquire( dvd_file->dvd->dev );
+  if( dvd_file->dvd->css_state &&
+      dvd_file->dvd->css_title != dvd_file->css_title ) {
     dvd_file->dvd->css_title = dvd_file->css_title;
     if( dvd_file->dvd->isImageFile ) {
         dvdinput_title( dvd_file->dvd->dev, (int)UDFFileBlockFile(dvd_file->dvd, dvd_file->udf_file, 0) );
@@ -1244,10 +1367,279 @@ ssize_t DVDReadBlocks( dvd_file_t *dvd_file, int offset,
     ret = DVDReadBlocksPath( dvd_file, (unsigned int)offset,
                              block_count, data, DVDINPUT_READ_DECRYPT );
   }
+  if( hold )
+    dvdinput_release( dvd_file->dvd->dev );
 
   return (ssize_t)ret;
 }
 
+const unsigned char *DVDMapBlocks( dvd_file_t *dvd_file, int offset,
+                                   size_t *block_count )
+{
+  const unsigned char *data;
+  uint32_t lb_number, run;
+
+  /* Check arguments. */
+  if( dvd_file == NULL || offset < 0 || block_count == NULL )
+    return NULL;
+
+  /* Mapped inputs never decrypt, and only UDF images are mapped whole. */
+  if( !dvd_file->dvd->isImageFile || dvd_file->dvd->css_state )
+    return NULL;
+
+  lb_number = UDFFileBlockFileRun( dvd_file->dvd, dvd_file->udf_file,
+                                   (uint32_t)offset, &run );
+  if( run == 0 )
+    return NULL;
+  if( run > *block_count )
+    run = (uint32_t)*block_count;
+
+  data = UDFMapBlocksRaw( dvd_file->dvd, lb_number, run );
+  if( data )
+    *block_count = run;
+  return data;
+}
+
+ssize_t DVDCopyBlocks( dvd_file_t *dvd_file, int offset, size_t byte_count,
+                       int fd )
+{
+  uint32_t lb_number, run, need;
+  size_t bytes = 0, len;
+  ssize_t ret;
+
+  /* Check arguments. */
+  if( dvd_file == NULL || offset < 0 || fd < 0 )
+    return -1;
+
+  /* The kernel copies what is on disc, so only for unencrypted images. */
+  if( !dvd_file->dvd->isImageFile || dvd_file->dvd->css_state )
+    return -1;
+
+  /* One copy per run of blocks that are contiguous in the image. */
+  while( bytes < byte_count ) {
+    lb_number = UDFFileBlockFileRun( dvd_file->dvd, dvd_file->udf_file,
+                                     (uint32_t)offset, &run );
+    if( run == 0 )
+      break;
+    need = (uint32_t)( ( byte_count - bytes + DVD_VIDEO_LB_LEN - 1 )
+                       / DVD_VIDEO_LB_LEN );
+    if( run > need )
+      run = need;
+    len = (size_t)run * DVD_VIDEO_LB_LEN;
+    if( len > byte_count - bytes )
+      len = byte_count - bytes;
+
+    ret = dvdinput_copy( dvd_file->dvd->dev, lb_number, len, fd );
+    if( ret < 0 ) {
+      if( bytes == 0 )
+        return -1;
+      break;
+    }
+    bytes += (size_t)ret;
+    if( (size_t)ret < len )
+      break;
+    offset += (int)run;
+  }
+
+  return (ssize_t)bytes;
+}
+
+/* A read queued with DVDQueueReadBlocks(), made of one input request per
+ * extent run. */
+struct dvd_read_request {
+  void *tag;
+  int pieces;      /* Input requests still in flight */
+  ssize_t blocks;  /* Read so far, or -1 once one failed */
+};
+
+struct dvd_read_queue_s {
+  dvd_reader_t *dvd;
+  dvdinput_queue_t input;    /* NULL when reads complete as they are queued */
+  int depth;
+
+  dvdinput_batch_t *pieces;  /* depth input requests */
+  int *owner;                /* Request each piece belongs to */
+  int *free_pieces, free_piece_count;
+
+  struct dvd_read_request *reqs; /* depth reads */
+  int *free_reqs, free_req_count;
+
+  int *ready;                /* Ring of reads completed when queued */
+  int ready_head, ready_count;
+};
+
+dvd_read_queue_t *DVDOpenReadQueue( dvd_reader_t *dvd, int depth )
+{
+  dvd_read_queue_t *queue;
+  int i;
+
+  if( dvd == NULL || depth <= 0 )
+    return NULL;
+
+  queue = calloc( 1, sizeof( *queue ) );
+  if( queue == NULL )
+    return NULL;
+  queue->dvd = dvd;
+  queue->depth = depth;
+  queue->pieces = malloc( depth * sizeof( *queue->pieces ) );
+  queue->owner = malloc( depth * sizeof( *queue->owner ) );
+  queue->free_pieces = malloc( depth * sizeof( *queue->free_pieces ) );
+  queue->reqs = malloc( depth * sizeof( *queue->reqs ) );
+  queue->free_reqs = malloc( depth * sizeof( *queue->free_reqs ) );
+  queue->ready = malloc( depth * sizeof( *queue->ready ) );
+  if( !queue->pieces || !queue->owner || !queue->free_pieces ||
+      !queue->reqs || !queue->free_reqs || !queue->ready ) {
+    DVDCloseReadQueue( queue );
+    return NULL;
+  }
+  for( i = 0; i < depth; i++ ) {
+    queue->free_pieces[ i ] = depth - 1 - i;
+    queue->free_reqs[ i ] = depth - 1 - i;
+  }
+  queue->free_piece_count = depth;
+  queue->free_req_count = depth;
+
+  /* Title keys are per read, so encrypted discs go through DVDReadBlocks() */
+  if( dvd->isImageFile && !dvd->css_state )
+    queue->input = dvdinput_queue_open( dvd->dev, depth );
+
+  return queue;
+}
+
+int DVDQueueReadBlocks( dvd_read_queue_t *queue, dvd_file_t *dvd_file,
+                        int offset, size_t block_count, unsigned char *data,
+                        void *tag )
+{
+  dvdinput_batch_t *batch[ DVD_READ_BATCH ];
+  struct dvd_read_request *req;
+  uint32_t run;
+  size_t queued;
+  int r, count;
+
+  /* Check arguments. */
+  if( queue == NULL || dvd_file == NULL || offset < 0 || data == NULL ||
+      tag == NULL || !queue->free_req_count )
+    return -1;
+
+  /* Extent runs the read needs, at most DVD_READ_BATCH for one submit */
+  count = 0;
+  if( queue->input && dvd_file->dvd == queue->dvd ) {
+    for( queued = 0; queued < block_count && count <= DVD_READ_BATCH; count++ ) {
+      UDFFileBlockFileRun( dvd_file->dvd, dvd_file->udf_file,
+                           (uint32_t)offset + queued, &run );
+      if( run == 0 || run > block_count - queued )
+        run = block_count - queued;
+      queued += run;
+    }
+  }
+
+  r = queue->free_reqs[ queue->free_req_count - 1 ];
+  req = &queue->reqs[ r ];
+  req->tag = tag;
+  req->blocks = 0;
+  req->pieces = 0;
+
+  if( count == 0 || count > DVD_READ_BATCH || count > queue->depth ) {
+    /* Can't be queued, read it now */
+    req->blocks = DVDReadBlocks( dvd_file, offset, block_count, data );
+    if( req->blocks < 0 )
+      req->blocks = -1;
+    queue->free_req_count--;
+    queue->ready[ ( queue->ready_head + queue->ready_count ) % queue->depth ] = r;
+    queue->ready_count++;
+    return 0;
+  }
+
+  if( count > queue->free_piece_count )
+    return -1;
+
+  for( queued = 0, req->pieces = 0; req->pieces < count; req->pieces++ ) {
+    int p = queue->free_pieces[ --queue->free_piece_count ];
+    dvdinput_batch_t *piece = &queue->pieces[ p ];
+
+    piece->lb = UDFFileBlockFileRun( dvd_file->dvd, dvd_file->udf_file,
+                                     (uint32_t)offset + queued, &run );
+    if( run == 0 || run > block_count - queued )
+      run = block_count - queued;
+    piece->blocks = (int)run;
+    piece->buffer = data + queued * DVD_VIDEO_LB_LEN;
+    queue->owner[ p ] = r;
+    batch[ req->pieces ] = piece;
+    queued += run;
+  }
+
+  if( dvdinput_queue_submit( queue->input, batch, count,
+                             DVDINPUT_READ_DECRYPT ) < 0 ) {
+    /* Only when the input has fewer slots than pieces handed out */
+    while( count-- )
+      queue->free_pieces[ queue->free_piece_count++ ] = batch[ count ] - queue->pieces;
+    return -1;
+  }
+  queue->free_req_count--;
+
+  return 0;
+}
+
+ssize_t DVDReapReadBlocks( dvd_read_queue_t *queue, void **tag, int wait )
+{
+  struct dvd_read_request *req;
+  dvdinput_batch_t *piece;
+  ssize_t blocks;
+  int r, p;
+
+  *tag = NULL;
+  if( queue == NULL )
+    return 0;
+
+  if( queue->ready_count ) {
+    r = queue->ready[ queue->ready_head ];
+    queue->ready_head = ( queue->ready_head + 1 ) % queue->depth;
+    queue->ready_count--;
+  } else {
+    if( queue->input == NULL )
+      return 0;
+
+    for( ;; ) {
+      piece = dvdinput_queue_reap( queue->input, wait );
+      if( piece == NULL )
+        return 0;
+
+      p = piece - queue->pieces;
+      r = queue->owner[ p ];
+      req = &queue->reqs[ r ];
+      queue->free_pieces[ queue->free_piece_count++ ] = p;
+      if( piece->result < 0 )
+        req->blocks = -1;
+      else if( req->blocks >= 0 )
+        req->blocks += piece->result;
+      if( --req->pieces == 0 )
+        break;
+    }
+  }
+
+  req = &queue->reqs[ r ];
+  *tag = req->tag;
+  blocks = req->blocks;
+  queue->free_reqs[ queue->free_req_count++ ] = r;
+
+  return blocks;
+}
+
+void DVDCloseReadQueue( dvd_read_queue_t *queue )
+{
+  if( queue == NULL )
+    return;
+
+  dvdinput_queue_close( queue->input );
+  free( queue->pieces );
+  free( queue->owner );
+  free( queue->free_pieces );
+  free( queue->reqs );
+  free( queue->free_reqs );
+  free( queue->ready );
+  free( queue );
+}
+
 int32_t DVDFileSeek( dvd_file_t *dvd_file, int32_t offset )
 {
   /* Check arguments. */
@@ -1283,10 +1675,37 @@ int DVDFileSeekForce(dvd_file_t *dvd_file, int offset, int force_size)
   return offset;
 }
 
+/* DVDReadBlocks() without the decryption, as the IFO reads need. */
+static int DVDReadBlocksPlain( dvd_file_t *dvd_file, uint32_t offset,
+                               size_t block_count, unsigned char *data )
+{
+  if( dvd_file->dvd->isImageFile )
+    return DVDReadBlocksUDF( dvd_file, offset, block_count, data,
+                             DVDINPUT_NOFLAGS );
+  return DVDReadBlocksPath( dvd_file, offset, block_count, data,
+                            DVDINPUT_NOFLAGS );
+}
+
+/* Reads block 'sector' into the file's sector buffer and copies 'len' bytes
+ * from 'start' within it to 'data'. */
+static int DVDReadPartialBlock( dvd_file_t *dvd_file, uint32_t sector,
+                                unsigned int start, size_t len,
+                                unsigned char *data )
+{
+  int ret;
+
+  ret = DVDReadBlocksPlain( dvd_file, sector, 1, dvd_file->secbuf );
+  if( ret != 1 )
+    return ret < 0 ? ret : -1;
+  memcpy( data, &dvd_file->secbuf[ start ], len );
+  return 0;
+}
+
 ssize_t DVDReadBytes( dvd_file_t *dvd_file, void *data, size_t byte_size )
 {
-  unsigned char *secbuf_base, *secbuf;
+  unsigned char *out = data;
   unsigned int numsec, seek_sector, seek_byte;
+  size_t head, tail, middle;
   int ret;
 
   /* Check arguments. */
@@ -1299,29 +1718,61 @@ ssize_t DVDReadBytes( dvd_file_t *dvd_file, void *data, size_t byte_size )
   numsec = ( ( seek_byte + byte_size ) / DVD_VIDEO_LB_LEN ) +
     ( ( ( seek_byte + byte_size ) % DVD_VIDEO_LB_LEN ) ? 1 : 0 );
 
-  secbuf_base = (unsigned char *) malloc( numsec * DVD_VIDEO_LB_LEN + 2048 );
-  secbuf = (unsigned char *)(((uintptr_t)secbuf_base & ~((uintptr_t)2047)) + 2048);
-  if( !secbuf_base ) {
-    fprintf( stderr, "libdvdread: Can't allocate memory "
-             "for file read!\n" );
-    return 0;
-  }
+  /* Whole blocks go straight to the caller's buffer. */
+  if( seek_byte == 0 && byte_size % DVD_VIDEO_LB_LEN == 0 ) {
+    ret = DVDReadBlocksPlain( dvd_file, seek_sector, (size_t) numsec, out );
+    if( ret != (int) numsec )
+      return ret < 0 ? ret : 0;
 
-  if( dvd_file->dvd->isImageFile ) {
-    ret = DVDReadBlocksUDF( dvd_file, (uint32_t) seek_sector,
-                            (size_t) numsec, secbuf, DVDINPUT_NOFLAGS );
-  } else {
-    ret = DVDReadBlocksPath( dvd_file, seek_sector,
-                             (size_t) numsec, secbuf, DVDINPUT_NOFLAGS );
+    DVDFileSeekForce(dvd_file, dvd_file->seek_pos + byte_size, -1);
+    return byte_size;
   }
 
-  if( ret != (int) numsec ) {
-    free( secbuf_base );
-    return ret < 0 ? ret : 0;
+  if( !dvd_file->secbuf_base ) {
+    dvd_file->secbuf_base = (unsigned char *)
+      malloc( DVD_SECBUF_BLOCKS * DVD_VIDEO_LB_LEN + 2048 );
+    if( !dvd_file->secbuf_base ) {
+      fprintf( stderr, "libdvdread: Can't allocate memory "
+               "for file read!\n" );
+      return 0;
+    }
+    dvd_file->secbuf = (unsigned char *)
+      (((uintptr_t)dvd_file->secbuf_base & ~((uintptr_t)2047)) + 2048);
   }
 
-  memcpy( data, &(secbuf[ seek_byte ]), byte_size );
-  free( secbuf_base );
+  if( numsec <= DVD_SECBUF_BLOCKS ) {
+    /* Small reads, the IFO structures: one read and a copy. */
+    ret = DVDReadBlocksPlain( dvd_file, seek_sector, (size_t) numsec,
+                              dvd_file->secbuf );
+    if( ret != (int) numsec )
+      return ret < 0 ? ret : 0;
+
+    memcpy( out, &dvd_file->secbuf[ seek_byte ], byte_size );
+  } else {
+    /* Larger ones: the partial first and last blocks through the buffer,
+     * the blocks in between directly. */
+    head = seek_byte ? DVD_VIDEO_LB_LEN - seek_byte : 0;
+    tail = ( seek_byte + byte_size ) % DVD_VIDEO_LB_LEN;
+    middle = ( byte_size - head - tail ) / DVD_VIDEO_LB_LEN;
+
+    if( head ) {
+      if( DVDReadPartialBlock( dvd_file, seek_sector, seek_byte, head,
+                               out ) < 0 )
+        return 0;
+      seek_sector++;
+    }
+    if( middle ) {
+      ret = DVDReadBlocksPlain( dvd_file, seek_sector, middle, out + head );
+      if( ret != (int) middle )
+        return ret < 0 ? ret : 0;
+      seek_sector += middle;
+    }
+    if( tail ) {
+      if( DVDReadPartialBlock( dvd_file, seek_sector, 0, tail,
+                               out + byte_size - tail ) < 0 )
+        return 0;
+    }
+  }
 
   DVDFileSeekForce(dvd_file, dvd_file->seek_pos + byte_size, -1);
   return byte_size;
@@ -1345,56 +1796,144 @@ uint64_t DVDFileSize64( dvd_file_t *dvd_file )
   return dvd_file->filebytes;
 }
 
-int DVDDiscID( dvd_reader_t *dvd, unsigned char *discid )
+/* Read what a disc ID covers, the first 10 IFO:s in order, i.e.
+ * VIDEO_TS.IFO and VTS_0?_0.IFO, back to back into one buffer.  Returns the
+ * number of files found, or -1 when one can't be read. */
+static int DVDDiscIDRead( dvd_reader_t *dvd, char **buffer_base,
+                          char **buffer, size_t *len )
 {
-  struct md5_ctx ctx;
-  int title;
+  dvd_file_t *dvd_files[ 10 ];
+  size_t file_size[ 10 ];
+  ssize_t bytes_read;
+  size_t total = 0;
+  int title, ret;
   int nr_of_files = 0;
 
-  /* Check arguments. */
-  if( dvd == NULL || discid == NULL )
-    return 0;
-
-  /* Go through the first 10 IFO:s, in order,
-   * and md5sum them, i.e  VIDEO_TS.IFO and VTS_0?_0.IFO */
-  md5_init_ctx( &ctx );
   for( title = 0; title < 10; title++ ) {
     dvd_file_t *dvd_file = DVDOpenFile( dvd, title, DVD_READ_INFO_FILE );
     if( dvd_file != NULL ) {
-      ssize_t bytes_read;
-      size_t file_size = dvd_file->filesize * DVD_VIDEO_LB_LEN;
-      char *buffer_base = malloc( file_size + 2048 );
-      char *buffer = (char *)(((uintptr_t)buffer_base & ~((uintptr_t)2047)) + 2048);
+      file_size[ nr_of_files ] = dvd_file->filesize * DVD_VIDEO_LB_LEN;
+      total += file_size[ nr_of_files ];
       dvd_file->udf_file = NULL;
+      dvd_files[ nr_of_files++ ] = dvd_file;
+    }
+  }
 
-      if( buffer_base == NULL ) {
-          DVDCloseFile( dvd_file );
-          fprintf( stderr, "libdvdread: DVDDiscId, failed to "
-                   "allocate memory for file read!\n" );
-          return -1;
-      }
+  *len = total;
+  *buffer_base = malloc( total + 2048 );
+  *buffer = (char *)(((uintptr_t)*buffer_base & ~((uintptr_t)2047)) + 2048);
+  ret = nr_of_files;
+  if( *buffer_base == NULL ) {
+    fprintf( stderr, "libdvdread: DVDDiscId, failed to "
+             "allocate memory for file read!\n" );
+    ret = -1;
+  }
 
-      bytes_read = DVDReadBytes( dvd_file, buffer, file_size );
-      if( bytes_read != file_size ) {
-          fprintf( stderr, "libdvdread: DVDDiscId read returned %zd bytes"
-                   ", wanted %zd\n", bytes_read, file_size );
-          DVDCloseFile( dvd_file );
-          free( buffer_base );
-          return -1;
+  total = 0;
+  for( title = 0; title < nr_of_files; title++ ) {
+    if( ret >= 0 ) {
+      bytes_read = DVDReadBytes( dvd_files[ title ], *buffer + total,
+                                 file_size[ title ] );
+      if( bytes_read != file_size[ title ] ) {
+        fprintf( stderr, "libdvdread: DVDDiscId read returned %zd bytes"
+                 ", wanted %zd\n", bytes_read, file_size[ title ] );
+        ret = -1;
       }
+      total += file_size[ title ];
+    }
+    DVDCloseFile( dvd_files[ title ] );
+  }
 
-      md5_process_bytes( buffer, file_size,  &ctx );
+  if( ret < 0 ) {
+    free( *buffer_base );
+    *buffer_base = NULL;
+  }
+  return ret;
+}
 
-      DVDCloseFile( dvd_file );
-      free( buffer_base );
-      nr_of_files++;
+int DVDDiscID( dvd_reader_t *dvd, unsigned char *discid )
+{
+  /* Check arguments. */
+  if( dvd == NULL || discid == NULL )
+    return 0;
+
+  return DVDDiscIDs( &dvd, 1, discid, NULL );
+}
+
+int DVDDiscIDs( dvd_reader_t **dvd, int count, unsigned char *discid,
+                int *status )
+{
+  /* One disc per MD5 lane, a new one starting as soon as a lane is done */
+  struct md5_ctx ctx[ MD5_MAX_LANES ];
+  struct md5_ctx *lane_ctx[ MD5_MAX_LANES ];
+  const void *lane_data[ MD5_MAX_LANES ];
+  char *buffer_base[ MD5_MAX_LANES ], *buffer;
+  size_t left[ MD5_MAX_LANES ], step;
+  int disc[ MD5_MAX_LANES ];
+  int lanes, active = 0, next = 0, failed = 0;
+  int i, ret;
+
+  /* Check arguments. */
+  if( dvd == NULL || discid == NULL || count < 0 )
+    return -1;
+
+  lanes = md5_lanes();
+  for( i = 0; i < lanes; i++ )
+    lane_ctx[ i ] = &ctx[ i ];
+
+  for( ;; ) {
+    while( active < lanes && next < count ) {
+      i = next++;
+      ret = dvd[ i ] ? DVDDiscIDRead( dvd[ i ], &buffer_base[ active ],
+                                      &buffer, &left[ active ] ) : -1;
+      if( status )
+        status[ i ] = ( ret > 0 ) ? 0 : -1;
+      if( ret <= 0 )
+        failed++;
+      if( ret < 0 )
+        continue;
+
+      md5_init_ctx( &ctx[ active ] );
+      if( left[ active ] == 0 ) {
+        /* No files, or only empty ones: the sum of nothing */
+        md5_finish_ctx( &ctx[ active ], &discid[ 16 * i ] );
+        free( buffer_base[ active ] );
+        continue;
+      }
+      lane_data[ active ] = buffer;
+      disc[ active ] = i;
+      active++;
+    }
+    if( active == 0 )
+      break;
+
+    /* IFO:s are whole blocks, so every step is too */
+    step = left[ 0 ];
+    for( i = 1; i < active; i++ )
+      if( left[ i ] < step )
+        step = left[ i ];
+    md5_process_lanes( lane_data, step, lane_ctx, active );
+
+    for( i = active - 1; i >= 0; i-- ) {
+      lane_data[ i ] = (const char *)lane_data[ i ] + step;
+      left[ i ] -= step;
+      if( left[ i ] )
+        continue;
+
+      md5_finish_ctx( &ctx[ i ], &discid[ 16 * disc[ i ] ] );
+      free( buffer_base[ i ] );
+
+      /* The last lane takes the place of the finished one */
+      active--;
+      ctx[ i ] = ctx[ active ];
+      lane_data[ i ] = lane_data[ active ];
+      buffer_base[ i ] = buffer_base[ active ];
+      left[ i ] = left[ active ];
+      disc[ i ] = disc[ active ];
     }
   }
-  md5_finish_ctx( &ctx, discid );
-  if(!nr_of_files)
-    return -1;
 
-  return 0;
+  return failed ? -1 : 0;
 }
 
 
@@ -1501,6 +2040,15 @@ int DVDUDFVolumeInfo( dvd_reader_t *dvd,
  *
  */
 dvd_dir_t *DVDOpenDir( dvd_reader_t *dvd, char *subdir )
+{
+  return DVDOpenDirFlags( dvd, subdir, 0 );
+}
+
+/**
+ * As DVDOpenDir(), with DVD_DIR_* flags controlling what DVDReadDir()
+ * fills in.
+ */
+dvd_dir_t *DVDOpenDirFlags( dvd_reader_t *dvd, char *subdir, int flags )
 {
   udf_file_t *udf_file;
   uint64_t filesize;
@@ -1531,6 +2079,7 @@ dvd_dir_t *DVDOpenDir( dvd_reader_t *dvd, char *subdir )
   result->dir_current  = 0;
   result->dir_length   = filesize;
   result->dir_file     = udf_file;
+  result->flags        = flags;
 
   return result;
 }
@@ -1559,6 +2108,19 @@ dvd_dirent_t *DVDReadDir( dvd_reader_t *dvd, dvd_dir_t *dirp )
   return &dirp->entry;
 
 }
+/**
+ * Completes the entry last returned by DVDReadDir() on a directory opened
+ * with DVD_DIR_NAMES_ONLY, by reading its File Entry. Returns the entry,
+ * or NULL if that failed.
+ */
+dvd_dirent_t *DVDStatDirent( dvd_reader_t *dvd, dvd_dir_t *dirp )
+{
+  if (!UDFMapDirent(dvd, dirp))
+    return NULL;
+
+  return &dirp->entry;
+}
+
 /**
  * closedir(3)-like function for traversing a UDF image.
  *
@@ -1573,6 +2135,7 @@ int DVDCloseDir( dvd_reader_t *dvd, dvd_dir_t *dirp )
 
   if (dirp->dir_file)
       UDFFreeFile(dvd, dirp->dir_file);
+  UDFFileClear(&dirp->entry.dir_file);
   free(dirp);
 
   return 0;
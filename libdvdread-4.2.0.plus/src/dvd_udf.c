@@ -31,6 +31,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -158,79 +159,282 @@ static int DVDReadLBUDF( dvd_reader_t *device, uint32_t lb_number,
     return block_count;
 }
 
-// Look for block in cache. Start from last found place.
-static unsigned char *cache_has(dvd_reader_t *device, uint32_t lb_number)
+/*
+ * The block cache is a fixed pool of cache_size blocks, indexed by an
+ * open-addressed (linear probing) hash table of entry numbers keyed on
+ * lbnumber. Eviction is CLOCK: a hit sets the entry's referenced bit, and
+ * the hand clears bits until it finds an unreferenced victim.
+ */
+#define CACHE_EMPTY (-1)
+
+/* Directory blocks fetched ahead of the scan, in as few reads as possible */
+#define UDF_DIR_READAHEAD 32
+
+static uint32_t cache_slot(dvd_reader_t *device, uint32_t lb_number)
 {
-    int i;
-    static int index = 0;
-
-    for (i = 0; i < NUM_UDF_CACHE; i++) {
-        if (device->udf_cache[index].lbnumber == lb_number)
-            return device->udf_cache[index].data;
-        index++;
-        if (index >= NUM_UDF_CACHE)
-            index = 0;
+    return (lb_number * 2654435761U) & device->cache_hash_mask;
+}
+
+static unsigned char *cache_block(dvd_reader_t *device, int entry)
+{
+    return &device->cache_data[ (size_t)entry * DVD_VIDEO_LB_LEN ];
+}
+
+/**
+ * Allocate the cache of a reader to hold 'blocks' blocks. A previous cache
+ * must have been released with UDFCacheFree(). Returns the new size, or 0
+ * if blocks is 0 or allocation failed (the cache is then disabled).
+ */
+int UDFCacheInit(dvd_reader_t *device, int blocks)
+{
+    uint32_t hash_size = 1;
+    uint32_t i;
+
+    device->udf_cache = NULL;
+    device->cache_hash = NULL;
+    device->cache_data_base = NULL;
+    device->cache_data = NULL;
+    device->cache_size = 0;
+    device->cache_hand = 0;
+    device->cache_hash_mask = 0;
+
+    if (blocks <= 0)
+        return 0;
+
+    /* Keep the table at most half full so probe chains stay short. */
+    while (hash_size < 2 * (uint32_t)blocks)
+        hash_size <<= 1;
+
+    device->udf_cache = calloc(blocks, sizeof(*device->udf_cache));
+    device->cache_hash = malloc(hash_size * sizeof(*device->cache_hash));
+    device->cache_data_base = malloc((size_t)blocks * DVD_VIDEO_LB_LEN + 2048);
+    if (!device->udf_cache || !device->cache_hash || !device->cache_data_base) {
+        UDFCacheFree(device);
+        return 0;
     }
-    return NULL;
+    device->cache_data = (unsigned char *)
+        (((uintptr_t)device->cache_data_base & ~((uintptr_t)2047)) + 2048);
+
+    for (i = 0; i < hash_size; i++)
+        device->cache_hash[i] = CACHE_EMPTY;
+    device->cache_hash_mask = hash_size - 1;
+    device->cache_size = blocks;
+    device->cache_hand = 0;
+
+    return blocks;
+}
+
+void UDFCacheFree(dvd_reader_t *device)
+{
+    free(device->udf_cache);
+    free(device->cache_hash);
+    free(device->cache_data_base);
+    device->udf_cache = NULL;
+    device->cache_hash = NULL;
+    device->cache_data_base = NULL;
+    device->cache_data = NULL;
+    device->cache_size = 0;
+    device->cache_hand = 0;
+    device->cache_hash_mask = 0;
 }
 
-static void cache_add(dvd_reader_t *device, uint32_t lb_number, unsigned char *data)
+// Look for block in cache. Returns the entry number, or CACHE_EMPTY.
+static int cache_has(dvd_reader_t *device, uint32_t lb_number)
 {
-    device->udf_cache[ device->cache_index ].lbnumber = lb_number;
-    memcpy(device->udf_cache[ device->cache_index ].data, data, DVD_VIDEO_LB_LEN);
+    uint32_t slot = cache_slot(device, lb_number);
+    int entry;
 
-    device->cache_index++;
-    if (device->cache_index >= NUM_UDF_CACHE)
-        device->cache_index = 0;
+    while ((entry = device->cache_hash[slot]) != CACHE_EMPTY) {
+        if (device->udf_cache[entry].lbnumber == lb_number) {
+            device->udf_cache[entry].referenced = 1;
+            return entry;
+        }
+        slot = (slot + 1) & device->cache_hash_mask;
+    }
+    return CACHE_EMPTY;
 }
 
+// Unlink an entry from the hash index, closing the gap in its probe chain.
+static void cache_unhash(dvd_reader_t *device, int entry)
+{
+    uint32_t mask = device->cache_hash_mask;
+    uint32_t hole = cache_slot(device, device->udf_cache[entry].lbnumber);
+    uint32_t next, home;
+
+    while (device->cache_hash[hole] != entry)
+        hole = (hole + 1) & mask;
+
+    for (next = (hole + 1) & mask;
+         device->cache_hash[next] != CACHE_EMPTY;
+         next = (next + 1) & mask) {
+        home = cache_slot(device, device->udf_cache[ device->cache_hash[next] ].lbnumber);
+        /* Move it back only if its home slot is not within (hole, next]. */
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            device->cache_hash[hole] = device->cache_hash[next];
+            hole = next;
+        }
+    }
+    device->cache_hash[hole] = CACHE_EMPTY;
+}
 
+// Pick an entry to reuse with the CLOCK algorithm and drop its old block.
+// Pinned entries are passed over; CACHE_EMPTY if every entry is pinned.
+static int cache_evict(dvd_reader_t *device)
+{
+    int entry, steps;
+
+    for (steps = 0; steps < 2 * device->cache_size; steps++) {
+        entry = device->cache_hand;
+        device->cache_hand = (entry + 1) % device->cache_size;
+
+        if (device->udf_cache[entry].pins)
+            continue;
+        if (!device->udf_cache[entry].valid)
+            return entry;
+        if (!device->udf_cache[entry].referenced) {
+            cache_unhash(device, entry);
+            device->udf_cache[entry].valid = 0;
+            return entry;
+        }
+        device->udf_cache[entry].referenced = 0;
+    }
+    return CACHE_EMPTY;
+}
 
-static int DVDReadLBUDFCached( dvd_reader_t *device, uint32_t lb_number,
-                               size_t block_count, unsigned char *data,
-                               int encrypted )
+static void cache_insert(dvd_reader_t *device, int entry, uint32_t lb_number)
 {
-    // for each block requested, check if it is already in cache
+    uint32_t slot = cache_slot(device, lb_number);
 
-    size_t count = block_count;
-    unsigned char *cache_data;
+    device->udf_cache[entry].lbnumber = lb_number;
+    device->udf_cache[entry].valid = 1;
+    device->udf_cache[entry].referenced = 1;
+
+    while (device->cache_hash[slot] != CACHE_EMPTY)
+        slot = (slot + 1) & device->cache_hash_mask;
+    device->cache_hash[slot] = entry;
+}
 
-    if (!device->udfcache_level) return DVDReadLBUDF(device, lb_number, block_count,
-                                                     data, encrypted);
+/*
+ * Borrow block lb_number. On a hit the block is returned in place, on a miss
+ * it is read straight into a free cache entry; either way the entry stays
+ * pinned until it is handed back with cache_put(). When the cache is off or
+ * fully pinned the block is read into 'fallback' instead, and *entry is
+ * CACHE_EMPTY; the same goes for a mapped image, where the block is used
+ * where it lies. Returns NULL if the block could not be read.
+ */
+static const uint8_t *cache_get(dvd_reader_t *device, uint32_t lb_number,
+                                uint8_t *fallback, int *entry)
+{
+    const uint8_t *data;
+    int e = CACHE_EMPTY;
 
+    *entry = CACHE_EMPTY;
 
-    while(count > 0) {
+    /* A mapped image is its own cache */
+    if ((data = UDFMapBlocksRaw(device, lb_number, 1)) != NULL)
+        return data;
 
-        if ((cache_data = cache_has(device, lb_number))) {
-            // It would be nicer if we could just work on the cache buffer
-            memcpy(data, cache_data, DVD_VIDEO_LB_LEN);
+    if (device->udfcache_level && device->cache_size) {
+        if ((e = cache_has(device, lb_number)) != CACHE_EMPTY) {
 #ifdef DEBUG
             fprintf(stderr, "CACHE: Using %u\r\n", lb_number);
 #endif
-
-        } else {
-            if (UDFReadBlocksRaw(device, lb_number, 1, data, encrypted) != 1)
-                return 0;
-            cache_add(device, lb_number, data);
+        } else if ((e = cache_evict(device)) != CACHE_EMPTY) {
+            if (UDFReadBlocksRaw(device, lb_number, 1,
+                                 cache_block(device, e), 0) != 1)
+                return NULL;
+            cache_insert(device, e, lb_number);
 #ifdef DEBUG
             fprintf(stderr, "CACHE: Adding %u\r\n", lb_number);
 #endif
         }
+    }
 
-        // Move forward a block
-        data += DVD_VIDEO_LB_LEN;
-        count--;
-        lb_number++;
+    if (e == CACHE_EMPTY) {
+        if (DVDReadLBUDF(device, lb_number, 1, fallback, 0) <= 0)
+            return NULL;
+        return fallback;
     }
-    return block_count;
+
+    device->udf_cache[e].pins++;
+    *entry = e;
+    return cache_block(device, e);
 }
 
+static void cache_put(dvd_reader_t *device, int entry)
+{
+    if (entry != CACHE_EMPTY)
+        device->udf_cache[entry].pins--;
+}
+
+/* Read count entries' worth of blocks starting at lb_number into the
+ * consecutive entries from 'first' (all pinned by the caller). */
+static void cache_fill_run(dvd_reader_t *device, uint32_t lb_number,
+                           int first, int count)
+{
+    int ok, i;
 
+    ok = DVDReadLBUDF(device, lb_number, count, cache_block(device, first), 0) > 0;
+#ifdef DEBUG
+    fprintf(stderr, "CACHE: Reading run %u+%d %s\r\n", lb_number, count,
+            ok ? "ok" : "failed");
+#endif
+    for (i = 0; i < count; i++) {
+        device->udf_cache[first + i].pins--;
+        if (ok)
+            cache_insert(device, first + i, lb_number + i);
+    }
+}
 
+/*
+ * Make sure blocks [lb_number, lb_number + count) are cached. Each run of
+ * blocks that are missing is fetched with one raw read, directly into the
+ * cache as long as CLOCK hands out consecutive entries (it does whenever it
+ * sweeps over cold entries, which is the common case). At most half the
+ * cache is filled per call so a prefetch can't evict itself.
+ */
+static void cache_prefetch(dvd_reader_t *device, uint32_t lb_number,
+                           uint32_t count)
+{
+    uint32_t i, run_lb = 0;
+    int first = CACHE_EMPTY, run = 0, entry;
+
+    if (!device->udfcache_level || !device->cache_size)
+        return;
+    /* Mapping them is hint enough */
+    if (UDFMapBlocksRaw(device, lb_number, count) != NULL)
+        return;
+    if (count > (uint32_t)device->cache_size / 2)
+        count = device->cache_size / 2;
+
+    for (i = 0; i < count; i++) {
+        if (cache_has(device, lb_number + i) != CACHE_EMPTY) {
+            if (run)
+                cache_fill_run(device, run_lb, first, run);
+            run = 0;
+            continue;
+        }
+        if ((entry = cache_evict(device)) == CACHE_EMPTY)
+            break;
+        /* Hold it so the hand can't hand it out again before the read. */
+        device->udf_cache[entry].pins++;
+        if (run && entry == first + run) {
+            run++;
+            continue;
+        }
+        if (run)
+            cache_fill_run(device, run_lb, first, run);
+        first = entry;
+        run_lb = lb_number + i;
+        run = 1;
+    }
+    if (run)
+        cache_fill_run(device, run_lb, first, run);
+}
 
 
 
-static int Unicodedecode( uint8_t *data, int len, char *target )
+static int Unicodedecode( const uint8_t *data, int len, char *target )
 {
     int p = 1, i = 0;
     int err = 0;
@@ -246,7 +450,7 @@ static int Unicodedecode( uint8_t *data, int len, char *target )
     return !err;
 }
 
-static int UDFDescriptor( uint8_t *data, uint16_t *TagID )
+static int UDFDescriptor( const uint8_t *data, uint16_t *TagID )
 {
     *TagID = GETN2(0);
     /* TODO: check CRC 'n stuff */
@@ -260,14 +464,14 @@ static int UDFExtentAD( uint8_t *data, uint32_t *Length, uint32_t *Location )
     return 0;
 }
 
-static int UDFSpaceBitmap( uint8_t *data, struct space_bitmap *bm)
+static int UDFSpaceBitmap( const uint8_t *data, struct space_bitmap *bm)
 {
     bm->NumberOfBits  = GETN4(2); // this can't be right
     bm->NumberOfBytes = GETN4(6);
     return 0;
 }
 
-static int UDFShortAD( uint8_t *data, struct AD *ad,
+static int UDFShortAD( const uint8_t *data, struct AD *ad,
                        struct Partition *partition )
 {
     ad->Length = GETN4(0);
@@ -278,7 +482,7 @@ static int UDFShortAD( uint8_t *data, struct AD *ad,
     return 0;
 }
 
-static int UDFLongAD( uint8_t *data, struct AD *ad )
+static int UDFLongAD( const uint8_t *data, struct AD *ad )
 {
     ad->Length = GETN4(0);
     ad->Flags = ad->Length >> 30;
@@ -289,7 +493,7 @@ static int UDFLongAD( uint8_t *data, struct AD *ad )
     return 0;
 }
 
-static int UDFExtAD( uint8_t *data, struct AD *ad )
+static int UDFExtAD( const uint8_t *data, struct AD *ad )
 {
     ad->Length = GETN4(0);
     ad->Flags = ad->Length >> 30;
@@ -300,14 +504,14 @@ static int UDFExtAD( uint8_t *data, struct AD *ad )
     return 0;
 }
 
-static int UDFICB( uint8_t *data, uint8_t *FileType, uint16_t *Flags )
+static int UDFICB( const uint8_t *data, uint8_t *FileType, uint16_t *Flags )
 {
     *FileType = GETN1(11);
     *Flags = GETN2(18);
     return 0;
 }
 
-static int UDFGetRootICB(uint8_t *data, struct AD *RootICB)
+static int UDFGetRootICB(const uint8_t *data, struct AD *RootICB)
 {
 
     UDFLongAD( &data[ 400 ], RootICB );
@@ -455,18 +659,184 @@ static int UDFLogVolume( dvd_reader_t *device, uint8_t *data)
     return 0;
 }
 
-static int UDFFileEntry( uint8_t *data, uint8_t *FileType,
-                         struct Partition *partition, udf_file_t *fad )
+/* Allocation Extent Descriptors followed per file at most; this also stops
+ * a chain that loops back on itself. */
+#define UDF_MAX_AED 4096
+
+/**
+ * Releases the AD chain of File and resets it to an empty file.
+ */
+void UDFFileClear( udf_file_t *File )
+{
+    free( File->AD_chain );
+    free( File->AD_block );
+    memset( File, 0, sizeof( *File ) );
+}
+
+/* Deep copy, src's chain is duplicated. Returns 1 on success. */
+static int UDFFileCopy( udf_file_t *dst, const udf_file_t *src )
+{
+    *dst = *src;
+    dst->AD_chain = NULL;
+    dst->AD_block = NULL;
+    if( src->num_AD ) {
+        dst->AD_chain = malloc( src->num_AD * sizeof( *dst->AD_chain ) );
+        dst->AD_block = malloc( src->num_AD * sizeof( *dst->AD_block ) );
+        if( !dst->AD_chain || !dst->AD_block ) {
+            UDFFileClear( dst );
+            return 0;
+        }
+        memcpy( dst->AD_chain, src->AD_chain,
+                src->num_AD * sizeof( *dst->AD_chain ) );
+        memcpy( dst->AD_block, src->AD_block,
+                src->num_AD * sizeof( *dst->AD_block ) );
+    }
+    return 1;
+}
+
+/**
+ * Collects the ADs of a File Entry, L_AD bytes at data[p], into
+ * fad->AD_chain. An AD of extent type 3 points at an Allocation Extent
+ * Descriptor (TagID 258) that carries the list on; it is followed.
+ * Returns 1 on success, 0 if the chain could not be read or stored; fad is
+ * then left an empty file.
+ */
+static int UDFReadADs( dvd_reader_t *device, const uint8_t *data,
+                       unsigned int p, uint32_t L_AD, uint16_t flags,
+                       struct Partition *partition, udf_file_t *fad )
+{
+    uint8_t aed_base[ DVD_VIDEO_LB_LEN + 2048 ];
+    uint8_t *aed = (uint8_t *)(((uintptr_t)aed_base & ~((uintptr_t)2047)) + 2048);
+    unsigned int end = p + L_AD, adsize;
+    uint32_t size = 0, hops = 0;
+    int entry = CACHE_EMPTY;
+    int ret = 1;
+    struct AD ad, *chain;
+    uint16_t TagID;
+
+    switch( flags & 0x0007 ) {
+    case 0:
+        adsize = 8;
+        break;
+    case 1:
+        adsize = 16;
+        break;
+    case 2:
+        adsize = 20;
+        break;
+    default: // type 3 is handled by the callers
+        return 1;
+    }
+
+    if( end > DVD_VIDEO_LB_LEN ) {
+        UDFFileClear( fad );
+        return 0;
+    }
+
+    while( p + adsize <= end ) {
+        ad.Partition = partition->Number;
+        ad.Flags = 0;
+
+        switch( flags & 0x0007 ) {
+        case 0:
+            UDFShortAD( &data[ p ], &ad, partition );
+            break;
+        case 1:
+            UDFLongAD( &data[ p ], &ad );
+            break;
+        case 2:
+            UDFExtAD( &data[ p ], &ad );
+            break;
+        }
+        p += adsize;
+
+        if( ad.Length == 0 ) // Terminates the list
+            break;
+
+        if( ad.Flags == 3 ) {
+            // The list goes on in an Allocation Extent Descriptor
+            cache_put( device, entry );
+            if( ++hops > UDF_MAX_AED ) {
+                ret = 0;
+                break;
+            }
+            data = cache_get( device, partition->fsd_location + ad.Location,
+                              aed, &entry );
+            if( data == NULL ) {
+                ret = 0;
+                break;
+            }
+            UDFDescriptor( data, &TagID );
+            end = 24 + GETN4( 20 );
+            if( TagID != 258 || end > DVD_VIDEO_LB_LEN ) {
+                ret = 0;
+                break;
+            }
+            p = 24;
+#ifdef DEBUG
+            fprintf(stderr, "libdvdread: AD chain continues at %d for %d bytes\r\n",
+                    ad.Location, end - 24);
+#endif
+            continue;
+        }
+
+        if( fad->num_AD == size ) {
+            size = size ? 2 * size : 4;
+            chain = realloc( fad->AD_chain, size * sizeof( *chain ) );
+            if( !chain ) {
+                ret = 0;
+                break;
+            }
+            fad->AD_chain = chain;
+        }
+        fad->AD_chain[ fad->num_AD++ ] = ad;
+
+#ifdef DEBUG
+        fprintf(stderr, "libdvdread: read AD chain %d (start %d len %d blocks %d)\r\n",
+                fad->num_AD-1, ad.Location, ad.Length, ad.Length/2048);
+#endif
+    }
+
+    cache_put( device, entry );
+
+    /* No partial chain: UDFFileBlockRun() needs AD_block for every AD */
+    if( !ret ) {
+        UDFFileClear( fad );
+        return 0;
+    }
+
+    /* File block each extent starts at, for UDFFileBlockRun() */
+    if( fad->num_AD ) {
+        uint32_t i, block = 0;
+
+        fad->AD_block = malloc( fad->num_AD * sizeof( *fad->AD_block ) );
+        if( !fad->AD_block ) {
+            UDFFileClear( fad );
+            return 0;
+        }
+        for( i = 0; i < fad->num_AD; i++ ) {
+            fad->AD_block[ i ] = block;
+            block += ( fad->AD_chain[ i ].Length + DVD_VIDEO_LB_LEN - 1 )
+                / DVD_VIDEO_LB_LEN;
+        }
+    }
+    return 1;
+}
+
+/* Returns 1 on success, 0 if the AD chain could not be read */
+static int UDFFileEntry( dvd_reader_t *device, const uint8_t *data,
+                         uint8_t *FileType, struct Partition *partition,
+                         udf_file_t *fad )
 {
     uint16_t flags;
     uint32_t L_EA, L_AD;
     unsigned int p;
 
+    UDFFileClear( fad );
     UDFICB( &data[ 16 ], FileType, &flags );
 
     /* Init ad for an empty file (i.e. there isn't a AD, L_AD == 0 ) */
     fad->Length = GETN8( 56 ); /* Really 8 bytes at 56 */
-    fad->num_AD = 0;
     fad->flags = flags;
 
     L_EA = GETN4( 168 );
@@ -486,39 +856,10 @@ static int UDFFileEntry( uint8_t *data, uint8_t *FileType,
 #ifdef DEBUG
         fprintf(stderr, "ICBTAG type 3. Actual file contents for %d bytes:\r\n", L_AD);
 #endif
-        return 0;
+        return 1;
     }
 
-    while( p < 176 + L_EA + L_AD ) {
-        struct AD *ad;
-
-        if (fad->num_AD >= UDF_MAX_AD_CHAINS) return 0;
-
-        ad =  &fad->AD_chain[fad->num_AD];
-        ad->Partition = partition->Number;
-        ad->Flags = 0;
-        fad->num_AD++;
-
-        switch( flags & 0x0007 ) {
-        case 0:
-            UDFShortAD( &data[ p ], ad, partition );
-            p += 8;
-            break;
-        case 1:
-            UDFLongAD( &data[ p ], ad );
-            p += 16;
-            break;
-        case 2:
-            UDFExtAD( &data[ p ], ad );
-            p += 20;
-            break;
-            // type 3 handled above.
-        default:
-            p += L_AD;
-            break;
-        }
-    }
-    return 0;
+    return UDFReadADs( device, data, p, L_AD, flags, partition, fad );
 }
 
 /* TagID 266
@@ -554,13 +895,15 @@ static int UDFFileEntry( uint8_t *data, uint8_t *FileType,
  * So old "l_ea" is now +216
  *
  */
-static int UDFExtFileEntry( uint8_t *data, uint8_t *FileType,
-                            struct Partition *partition, udf_file_t *fad )
+static int UDFExtFileEntry( dvd_reader_t *device, const uint8_t *data,
+                            uint8_t *FileType, struct Partition *partition,
+                            udf_file_t *fad )
 {
     uint16_t flags;
     uint32_t L_EA, L_AD;
     unsigned int p;
 
+    UDFFileClear( fad );
     UDFICB( &data[ 16 ], FileType, &flags );
     fad->flags = flags;
 
@@ -582,7 +925,6 @@ static int UDFExtFileEntry( uint8_t *data, uint8_t *FileType,
 
     /* Init ad for an empty file (i.e. there isn't a AD, L_AD == 0 ) */
     fad->Length = GETN8(56); // 64-bit.
-    fad->num_AD = 0;
 
     L_EA = GETN4( 208);
     L_AD = GETN4( 212);
@@ -598,52 +940,13 @@ static int UDFExtFileEntry( uint8_t *data, uint8_t *FileType,
 #ifdef DEBUG
         fprintf(stderr, "ICBTAG type 3. Actual file contents for %d bytes:\r\n", L_AD);
 #endif
-        return 0;
+        return 1;
     }
 
-
-
-    while( p < 216 + L_EA + L_AD ) {
-        struct AD *ad;
-
-        if (fad->num_AD >= UDF_MAX_AD_CHAINS) return 0;
-
-        ad =  &fad->AD_chain[fad->num_AD];
-        ad->Partition = partition->Number;
-        ad->Flags = 0;
-        fad->num_AD++;
-
-        switch( flags & 0x0007 ) {
-        case 0:
-            UDFShortAD( &data[ p ], ad, partition );
-            p += 8;
-            break;
-        case 1:
-            UDFLongAD( &data[ p ], ad );
-            p += 16;
-            break;
-        case 2:
-            UDFExtAD( &data[ p ], ad );
-            p += 20;
-            break;
-            // type 3 handled above
-        default:
-            p += L_AD;
-            break;
-        }
-#ifdef DEBUG
-        fprintf(stderr, "libdvdread: read AD chain %d (start %d len %d blocks %d)\r\n",
-                fad->num_AD-1,
-                fad->AD_chain[fad->num_AD-1].Location,
-                fad->AD_chain[fad->num_AD-1].Length,
-                fad->AD_chain[fad->num_AD-1].Length/2048);
-#endif
-
-    }
-    return 0;
+    return UDFReadADs( device, data, p, L_AD, flags, partition, fad );
 }
 
-static int UDFFileIdentifier( uint8_t *data, uint8_t *FileCharacteristics,
+static int UDFFileIdentifier( const uint8_t *data, uint8_t *FileCharacteristics,
                               char *FileName, struct AD *FileICB )
 {
     uint8_t L_FI;
@@ -663,7 +966,8 @@ static int UDFFileIdentifier( uint8_t *data, uint8_t *FileCharacteristics,
  * Maps ICB to FileAD
  * ICB: Location of ICB of directory to scan
  * FileType: Type of the file
- * File: Location of file the ICB is pointing to
+ * File: Location of file the ICB is pointing to. Must be empty or hold an
+ *       earlier result, whose AD chain is released.
  * return 1 on success, 0 on error;
  */
 static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
@@ -671,6 +975,8 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
 {
     uint8_t LogBlock_base[DVD_VIDEO_LB_LEN + 2048];
     uint8_t *LogBlock = (uint8_t *)(((uintptr_t)LogBlock_base & ~((uintptr_t)2047)) + 2048);
+    const uint8_t *data;
+    int entry, ok;
     uint32_t lbnum;
     uint16_t TagID;
 
@@ -679,7 +985,7 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
     //lbnum = ICB.Location;
 
     lbnum = partition->fsd_location + ICB.Location;
-    memset(File, 0, sizeof(*File));
+    UDFFileClear(File);
 
 #ifdef DEBUG
     fprintf(stderr, "MapICB starting at %d,%d -> %d (Metadata Mainfile num_AD %d)\r\n",
@@ -689,13 +995,16 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
 
 
     do {
-        if( DVDReadLBUDFCached( device, lbnum++, 1, LogBlock, 0 ) <= 0 )
+        if( ( data = cache_get( device, lbnum++, LogBlock, &entry ) ) == NULL )
             TagID = 0;
         else
-            UDFDescriptor( LogBlock, &TagID );
+            UDFDescriptor( data, &TagID );
 
         if( TagID == 261 ) {
-            UDFFileEntry( LogBlock, FileType, partition, File );
+            ok = UDFFileEntry( device, data, FileType, partition, File );
+            cache_put( device, entry );
+            if( !ok )
+                return 0;
 #ifdef DEBUG
             fprintf(stderr, "UDFMapICB TagID %d File with filetype %d\r\n",
                     TagID, *FileType);
@@ -704,7 +1013,10 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
         };
         /* ExtendedFileInfo */
         if( TagID == 266 ) {
-            UDFExtFileEntry( LogBlock, FileType, partition, File );
+            ok = UDFExtFileEntry( device, data, FileType, partition, File );
+            cache_put( device, entry );
+            if( !ok )
+                return 0;
 #ifdef DEBUG
             fprintf(stderr, "UDFMapICB TagID %d ExtFile with filetype %d\r\n",
                     TagID, *FileType);
@@ -733,6 +1045,8 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
 
             return 1;
         }
+        if( data != NULL )
+            cache_put( device, entry );
     } while( ( lbnum <= partition->Start + ICB.Location + ( ICB.Length - 1 )
                / DVD_VIDEO_LB_LEN ) && ( TagID != 261 )  && (TagID != 266));
 
@@ -740,28 +1054,158 @@ static int UDFMapICB( dvd_reader_t *device, struct AD ICB, uint8_t *FileType,
 }
 
 
+/*
+ * UDFScanDirX looks at a window of two consecutive directory blocks, so the
+ * FID that straddles the block boundary can still be parsed in one piece.
+ * Both blocks are borrowed from the cache; only a straddling FID is copied,
+ * into scratch at its window offset. Scratch (two blocks) is also where the
+ * blocks land if the cache can't hold them.
+ */
+struct dir_window {
+    const uint8_t *block[2];
+    int entry[2];
+    uint8_t *scratch;
+};
+
+static void dir_window_release( dvd_reader_t *device, struct dir_window *w )
+{
+    cache_put( device, w->entry[0] );
+    cache_put( device, w->entry[1] );
+    w->block[0] = w->block[1] = NULL;
+    w->entry[0] = w->entry[1] = CACHE_EMPTY;
+}
+
+/* Coalesces block numbers into runs for cache_prefetch() */
+struct prefetch_run {
+    uint32_t start;
+    uint32_t count;
+};
+
+/* Single blocks are left to cache_get(), it costs the same read. */
+static void prefetch_flush( dvd_reader_t *device, struct prefetch_run *run )
+{
+    if( run->count > 1 )
+        cache_prefetch( device, run->start, run->count );
+    run->count = 0;
+}
+
+static void prefetch_add( dvd_reader_t *device, struct prefetch_run *run,
+                          uint32_t lb )
+{
+    if( run->count && lb == run->start + run->count ) {
+        run->count++;
+        return;
+    }
+    prefetch_flush( device, run );
+    run->start = lb;
+    run->count = 1;
+}
+
+/* Pull the next few blocks of a directory into the cache, one read per
+ * physically contiguous stretch. */
+static void dir_readahead( dvd_reader_t *device, udf_file_t *dir,
+                           uint32_t lbnum )
+{
+    uint32_t end = ( dir->Length + DVD_VIDEO_LB_LEN - 1 ) / DVD_VIDEO_LB_LEN;
+    struct prefetch_run run = { 0, 0 };
+
+    if( end > lbnum + UDF_DIR_READAHEAD )
+        end = lbnum + UDF_DIR_READAHEAD;
+
+    for( ; lbnum < end; lbnum++ )
+        prefetch_add( device, &run, UDFFileBlockDir( device, dir, lbnum ) );
+    prefetch_flush( device, &run );
+}
+
+static int dir_window_load( dvd_reader_t *device, struct dir_window *w,
+                            udf_file_t *dir, uint32_t lbnum )
+{
+    dir_window_release( device, w );
+    dir_readahead( device, dir, lbnum );
+    w->block[0] = cache_get( device, UDFFileBlockDir( device, dir, lbnum ),
+                             w->scratch, &w->entry[0] );
+    if( !w->block[0] )
+        return 0;
+    w->block[1] = cache_get( device, UDFFileBlockDir( device, dir, lbnum + 1 ),
+                             &w->scratch[ DVD_VIDEO_LB_LEN ], &w->entry[1] );
+    return w->block[1] != NULL;
+}
+
+/* Contiguous view of len bytes at window offset pos, NULL if out of range */
+static const uint8_t *dir_window_at( struct dir_window *w, unsigned int pos,
+                                     unsigned int len )
+{
+    if( pos + len <= DVD_VIDEO_LB_LEN )
+        return &w->block[0][ pos ];
+    if( !w->block[1] || pos + len > 2 * DVD_VIDEO_LB_LEN )
+        return NULL;
+    if( pos >= DVD_VIDEO_LB_LEN )
+        return &w->block[1][ pos - DVD_VIDEO_LB_LEN ];
+
+    if( w->block[0] != w->scratch )
+        memcpy( &w->scratch[ pos ], &w->block[0][ pos ],
+                DVD_VIDEO_LB_LEN - pos );
+    if( w->block[1] != &w->scratch[ DVD_VIDEO_LB_LEN ] )
+        memcpy( &w->scratch[ DVD_VIDEO_LB_LEN ], w->block[1],
+                pos + len - DVD_VIDEO_LB_LEN );
+    return &w->scratch[ pos ];
+}
+
+/* File entries of a directory are usually written back to back, so fetch
+ * the ICBs named by the FIDs from window offset pos to the end of the first
+ * block together, before UDFMapICB() asks for them one by one. */
+static void dir_icb_readahead( dvd_reader_t *device, struct dir_window *w,
+                               unsigned int pos )
+{
+    struct prefetch_run run = { 0, 0 };
+    const uint8_t *fid;
+    uint16_t TagID;
+    struct AD FileICB;
+
+    while( pos + 38 <= DVD_VIDEO_LB_LEN ) {
+        fid = &w->block[0][ pos ];
+        UDFDescriptor( fid, &TagID );
+        if( TagID != 257 )
+            break;
+        if( !( fid[18] & ( 4 | 8 ) ) ) { // Skip deleted and parent entries
+            UDFLongAD( &fid[20], &FileICB );
+            prefetch_add( device, &run,
+                          device->partition.fsd_location + FileICB.Location );
+        }
+        pos += 4 * ( ( 38 + fid[19] + ( fid[36] | ( fid[37] << 8 ) ) + 3 ) / 4 );
+    }
+    prefetch_flush( device, &run );
+}
+
 /**
- * Low-level function used by DVDReadDir to simulate readdir().
- * Returns ONE directory entry at a time, or NULL when finished/failed.
- *
+ * Steps to the next visible FID of a directory and fills in its name in
+ * dirp->entry, without looking at the ICB it points to.
+ * Returns 1 with the FID's characteristics and ICB, 0 at the end of the
+ * directory and -1 if it could not be read.
  */
-int UDFScanDirX( dvd_reader_t *device,
-                 dvd_dir_t *dirp )
+static int UDFScanDirFID( dvd_reader_t *device, dvd_dir_t *dirp,
+                          uint8_t *FileChar, struct AD *FileICB )
 {
     char filename[ MAX_UDF_FILE_NAME_LEN ];
     uint8_t directory_base[ 2 * DVD_VIDEO_LB_LEN + 2048];
     uint8_t *directory = (uint8_t *)(((uintptr_t)directory_base & ~((uintptr_t)2047)) + 2048);
+    struct dir_window window;
+    const uint8_t *fid;
     uint32_t lbnum;
     uint16_t TagID;
     uint8_t filechar;
     unsigned int p;
-    struct AD FileICB;
     udf_file_t File;
     uint8_t filetype;
     uint32_t offset = 0;
+    int failed = 0;
 
     memset(&File, 0, sizeof(File));
 
+    window.block[0] = window.block[1] = NULL;
+    window.entry[0] = window.entry[1] = CACHE_EMPTY;
+    window.scratch = directory;
+
     /* Scan dir for ICB of file */
     lbnum = dirp->dir_current;
 
@@ -776,14 +1220,13 @@ int UDFScanDirX( dvd_reader_t *device,
                 dirp->dir_file->info_location);
 #endif
 
-        if( DVDReadLBUDFCached( device,
-                          dirp->dir_file->info_location,
-                          1, directory, 0 ) <= 0 ) {
-            return 0;
-        }
-        UDFDescriptor( &directory[ 0 ], &TagID );
+        window.block[0] = cache_get( device, dirp->dir_file->info_location,
+                                     directory, &window.entry[0] );
+        if( !window.block[0] )
+            return -1;
+        UDFDescriptor( window.block[0], &TagID );
         if ((TagID == 266)) {
-            UDFExtFileEntry( directory, &filetype, &device->partition, &File );
+            UDFExtFileEntry( device, window.block[0], &filetype, &device->partition, &File );
             if ((filetype == 4) && ICB_DATA_IN_AD_SPACE(File.flags)) {
                 offset = File.content_offset;
 #ifdef DEBUG
@@ -791,6 +1234,7 @@ int UDFScanDirX( dvd_reader_t *device,
                         offset, dirp->dir_length);
 #endif
             }
+            UDFFileClear( &File );
         }
     } else {
         // Data in file content, follow AD
@@ -805,17 +1249,12 @@ int UDFScanDirX( dvd_reader_t *device,
 
         // We read 2 dirs here, since FIDs (40b) dont fit nicely in 2048b blocks
         // which enables us to get the last FID in, before reading next.
-        if( DVDReadLBUDFCached( device,
-                          UDFFileBlockDir(device, dirp->dir_file, lbnum),
-                          1, directory, 0 ) <= 0 ) {
-            return 0;
-        }
-
-        if( DVDReadLBUDFCached( device,
-                          UDFFileBlockDir(device, dirp->dir_file, lbnum+1),
-                          1, &directory[DVD_VIDEO_LB_LEN], 0 ) <= 0 ) {
-            return 0;
+        if( !dir_window_load( device, &window, dirp->dir_file, lbnum ) ) {
+            dir_window_release( device, &window );
+            return -1;
         }
+        if( !dirp->current_p )
+            dir_icb_readahead( device, &window, 0 );
     }
 
 
@@ -851,22 +1290,21 @@ int UDFScanDirX( dvd_reader_t *device,
             //dirp->current_p = 0;
             //p = 0;
 
-            if( DVDReadLBUDFCached( device,
-                              UDFFileBlockDir(device, dirp->dir_file, lbnum),
-                              1, directory, 0 ) <= 0 ) {
-                return 0;
-            }
-            if( DVDReadLBUDFCached( device,
-                              UDFFileBlockDir(device, dirp->dir_file, lbnum+1),
-                              1, &directory[DVD_VIDEO_LB_LEN], 0 ) <= 0 ) {
-                return 0;
+            if( !dir_window_load( device, &window, dirp->dir_file, lbnum ) ) {
+                failed = 1;
+                break;
             }
+            dir_icb_readahead( device, &window, p + offset );
 
         }
 
 
-        // Process block for FIDs
-        UDFDescriptor( &directory[ p + offset], &TagID );
+        // Process block for FIDs; the fixed part first, then the whole FID
+        if( ( fid = dir_window_at( &window, p + offset, 38 ) ) == NULL ) {
+            failed = 1;
+            break;
+        }
+        UDFDescriptor( fid, &TagID );
 
 #ifdef DEBUG
         fprintf(stderr, "TagID %d: p %d\n", TagID, p);
@@ -874,8 +1312,13 @@ int UDFScanDirX( dvd_reader_t *device,
 
         if( TagID == 257 ) { // FID
 
-            p += UDFFileIdentifier( &directory[ p + offset], &filechar,
-                                    filename, &FileICB );
+            fid = dir_window_at( &window, p + offset,
+                                 38 + fid[19] + ( fid[36] | ( fid[37] << 8 ) ) );
+            if( fid == NULL ) {
+                failed = 1;
+                break;
+            }
+            p += UDFFileIdentifier( fid, &filechar, filename, FileICB );
 
 #ifdef DEBUG
             fprintf(stderr, "Read entryname '%s', FileChar %02X\r\n", filename, filechar);
@@ -898,23 +1341,8 @@ int UDFScanDirX( dvd_reader_t *device,
                 dirp->entry.d_name[ sizeof(dirp->entry.d_name) - 1 ] = 0;
             }
 
-            /* Look up the Filedata */
-            if( !UDFMapICB( device, FileICB, &filetype, &device->partition,
-                            &(dirp->entry.dir_file)))
-                return 0;
-
-            if (filetype == 4)
-                dirp->entry.d_type = DVD_DT_DIR;
-            else
-                dirp->entry.d_type = DVD_DT_REG;
-            /* Add more types? */
-
-            dirp->entry.d_filesize = dirp->entry.dir_file.Length;
-
-#ifdef DEBUG
-            fprintf(stderr, "Returning 1 valid dirp: location %d. infoloc %d\r\n",
-                    dirp->entry.dir_file.AD_chain[0].Location, dirp->entry.dir_file.info_location);
-#endif
+            dir_window_release( device, &window );
+            *FileChar = filechar;
             return 1;
 
         } else {
@@ -922,7 +1350,8 @@ int UDFScanDirX( dvd_reader_t *device,
             fprintf(stderr, "failed - not 257, whats next: \r\n");
 
             if (TagID == 266) {
-                UDFExtFileEntry( directory, &filetype, &device->partition, &File );
+                UDFExtFileEntry( device, window.block[0], &filetype, &device->partition, &File );
+                UDFFileClear( &File );
 
                 fprintf(stderr, "TagID %d with filetype %d\r\n",
                         TagID, filetype);
@@ -930,9 +1359,13 @@ int UDFScanDirX( dvd_reader_t *device,
 #endif
 
             /* Not TagID 257 */
-            return 0;
+            dir_window_release( device, &window );
+            return -1;
         }
     }
+    dir_window_release( device, &window );
+    if( failed ) /* Read failed or FID ran off the window */
+        return -1;
     /* End of DIR contents */
 #ifdef DEBUG
     fprintf(stderr, "UDFScanDirX: Reach EOF of directory\r\n");
@@ -941,6 +1374,67 @@ int UDFScanDirX( dvd_reader_t *device,
     return 0;
 }
 
+/**
+ * Low-level function used by DVDReadDir to simulate readdir().
+ * Returns ONE directory entry at a time, or NULL when finished/failed.
+ *
+ */
+int UDFScanDirX( dvd_reader_t *device,
+                 dvd_dir_t *dirp )
+{
+    uint8_t filechar;
+
+    dirp->entry_mapped = 0;
+
+    if( UDFScanDirFID( device, dirp, &filechar, &dirp->entry_icb ) <= 0 )
+        return 0;
+
+    if( dirp->flags & DVD_DIR_NAMES_ONLY ) {
+        /* Trust the FID's directory bit, the File Entry waits */
+        if( filechar & 2 )
+            dirp->entry.d_type = DVD_DT_DIR;
+        else
+            dirp->entry.d_type = DVD_DT_REG;
+        dirp->entry.d_filesize = 0;
+        return 1;
+    }
+
+    return UDFMapDirent( device, dirp );
+}
+
+/**
+ * Looks up the File Entry of the entry UDFScanDirX() last returned, filling
+ * in its type, size and AD chain. Does nothing if that was done already.
+ * Returns 1 on success, 0 on error.
+ */
+int UDFMapDirent( dvd_reader_t *device, dvd_dir_t *dirp )
+{
+    uint8_t filetype;
+
+    if( dirp->entry_mapped )
+        return 1;
+
+    /* Look up the Filedata */
+    if( !UDFMapICB( device, dirp->entry_icb, &filetype, &device->partition,
+                    &(dirp->entry.dir_file)))
+        return 0;
+
+    if (filetype == 4)
+        dirp->entry.d_type = DVD_DT_DIR;
+    else
+        dirp->entry.d_type = DVD_DT_REG;
+    /* Add more types? */
+
+    dirp->entry.d_filesize = dirp->entry.dir_file.Length;
+    dirp->entry_mapped = 1;
+
+#ifdef DEBUG
+    fprintf(stderr, "Returning 1 valid dirp: location %d. infoloc %d\r\n",
+            dirp->entry.dir_file.AD_chain[0].Location, dirp->entry.dir_file.info_location);
+#endif
+    return 1;
+}
+
 static int UDFGetAVDP( dvd_reader_t *device,
                        struct avdp_t *avdp)
 {
@@ -1073,6 +1567,8 @@ static int UDFFindPartition( dvd_reader_t *device, int partnum,
  */
 void UDFFreeFile(dvd_reader_t *device, udf_file_t *File)
 {
+    if (File)
+        UDFFileClear(File);
     free(File);
 }
 
@@ -1089,19 +1585,28 @@ void UDFFreeFile(dvd_reader_t *device, udf_file_t *File)
  * in bytes..? Can bytes be uneven blocksize in the middle of a chain?
  *
  */
-uint32_t UDFFileBlockRaw(dvd_reader_t *device, udf_file_t *File, uint32_t file_block)
+static uint32_t UDFFileBlockRun(dvd_reader_t *device, udf_file_t *File,
+                                uint32_t file_block, uint32_t *count)
 {
-    uint32_t result, i, offset;
+    uint32_t lo, hi, mid, i, offset, end;
+
+    if (count) *count = 0;
 
-    if (!File) return 0;
+    if (!File || !File->num_AD) return 0;
 
-    /* Look through the chain to see where this block would belong. */
-    for (i = 0, offset = 0; i < File->num_AD; i++) {
-        /* Is "file_block" inside this chain? Then use this chain. */
-        if (file_block < (offset +
-                          (File->AD_chain[i].Length /  DVD_VIDEO_LB_LEN))) break;
-        // offset += (File->AD_chain[i].Length /  DVD_VIDEO_LB_LEN);
+    /* Last extent starting at or before file_block; AD_block[0] is 0. */
+    lo = 0;
+    hi = File->num_AD;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (File->AD_block[mid] <= file_block)
+            lo = mid;
+        else
+            hi = mid;
     }
+    i = lo;
+    offset = File->AD_block[i];
+    end = offset + (File->AD_chain[i].Length + DVD_VIDEO_LB_LEN - 1) / DVD_VIDEO_LB_LEN;
 
     /* If it is not defined in the AD chains, we should return an error, but
      * in the interest of being backward (in)compatible with the original
@@ -1109,21 +1614,41 @@ uint32_t UDFFileBlockRaw(dvd_reader_t *device, udf_file_t *File, uint32_t file_b
      * one contiguous long chain, in case some API software out there relies on
      * this incorrect behavior.
      */
-    if (i >= File->num_AD) i = 0;
+    if (file_block >= end) {
+#ifdef DEBUG
+        fprintf(stderr, " BlockPos: +%d is past the %d AD chains, assuming contiguous\r\n",
+                file_block, File->num_AD);
+#endif
+        return File->AD_chain[0].Location + file_block;
+    }
+
+    if (count) {
+        /* Extents that follow on physically extend the run */
+        while (i + 1 < File->num_AD &&
+               File->AD_chain[i].Location + (end - File->AD_block[i]) ==
+               File->AD_chain[i + 1].Location) {
+            i++;
+            end = File->AD_block[i] +
+                (File->AD_chain[i].Length + DVD_VIDEO_LB_LEN - 1) / DVD_VIDEO_LB_LEN;
+        }
+        *count = end - file_block;
+    }
 
 #ifdef DEBUG
-    fprintf(stderr, " BlockPos: mapping +%d into file, found in chain %d starting at %d (for len %d) (offset %d, with FSD/Start at %d) resulting at: %d. Flags are %02X\r\n",
-            file_block, i, File->AD_chain[i].Location,
-            File->AD_chain[i].Length,
+    fprintf(stderr, " BlockPos: mapping +%d into file, found in chain %d starting at %d (for len %d) (offset %d) resulting at: %d. Flags are %02X\r\n",
+            file_block, lo, File->AD_chain[lo].Location,
+            File->AD_chain[lo].Length,
             offset,
-            result,
-            result + File->AD_chain[i].Location + file_block - offset,
+            File->AD_chain[lo].Location + file_block - offset,
             File->flags);
 #endif
 
-    result = File->AD_chain[i].Location + file_block - offset;
+    return File->AD_chain[lo].Location + file_block - offset;
+}
 
-    return result;
+uint32_t UDFFileBlockRaw(dvd_reader_t *device, udf_file_t *File, uint32_t file_block)
+{
+    return UDFFileBlockRun(device, File, file_block, NULL);
 }
 
 // Positions for Directories, based off FSD
@@ -1140,7 +1665,241 @@ uint32_t UDFFileBlockFile(dvd_reader_t *device, udf_file_t *File, uint32_t file_
 
 }
 
+/**
+ * As UDFFileBlockFile(), and returns in *count how many blocks from there on
+ * are physically contiguous, to the end of the file's last extent. *count is
+ * 0 when file_block lies past the extents.
+ */
+uint32_t UDFFileBlockFileRun(dvd_reader_t *device, udf_file_t *File,
+                             uint32_t file_block, uint32_t *count)
+{
+    return UDFFileBlockRun(device, File, file_block, count) + device->partition.Start;
+}
+
+
+
+/*
+ * Directory index: the first path lookup in a directory scans its FIDs once
+ * and records every visible name, case-folded, with the ICB it points to.
+ * Later lookups in that directory are a hash probe and a single UDFMapICB().
+ * Directories are keyed by the block holding their FIDs; the indexes hang
+ * off the reader in a small chained table and live until DVDClose().
+ */
+struct udf_dir_entry {
+    uint32_t hash;     /* Of the folded name */
+    uint32_t name;     /* Offset of the folded name in names */
+    struct AD icb;
+};
+
+struct udf_dir_index_s {
+    uint32_t key;
+    uint32_t count;
+    uint32_t mask;
+    int32_t *slots;    /* Name hash -> entries[], -1 when empty */
+    struct udf_dir_entry *entries;
+    char *names;
+    struct udf_dir_index_s *next;
+};
+
+static uint32_t dir_index_key( dvd_reader_t *device, udf_file_t *dir )
+{
+    if( dir->info_location )
+        return dir->info_location;
+    return UDFFileBlockDir( device, dir, 0 );
+}
+
+/* Case-fold like strcasecmp() does and hash the result (FNV-1a) */
+static uint32_t dir_index_fold( const char *name, char *folded )
+{
+    uint32_t hash = 2166136261U;
+
+    do {
+        *folded = tolower( (unsigned char)*name );
+        hash = ( hash ^ (uint8_t)*folded ) * 16777619U;
+        folded++;
+    } while( *name++ );
+
+    return hash;
+}
+
+static void dir_index_free( udf_dir_index_t *index )
+{
+    free( index->slots );
+    free( index->entries );
+    free( index->names );
+    free( index );
+}
+
+void UDFDirIndexFree( dvd_reader_t *device )
+{
+    udf_dir_index_t *index;
+    int i;
+
+    for( i = 0; i < UDF_DIR_INDEX_BUCKETS; i++ ) {
+        while( ( index = device->dir_index[ i ] ) != NULL ) {
+            device->dir_index[ i ] = index->next;
+            dir_index_free( index );
+        }
+    }
+}
+
+static udf_dir_index_t *dir_index_build( dvd_reader_t *device,
+                                         udf_file_t *dir, uint32_t key )
+{
+    udf_dir_index_t *index;
+    dvd_dir_t dirp;
+    struct AD FileICB;
+    struct udf_dir_entry *entry;
+    uint32_t entries_size = 0, names_size = 0, names_used = 0;
+    uint32_t slot, i, size, len;
+    uint8_t filechar;
+    int ret;
+    void *p;
+
+    index = calloc( 1, sizeof( *index ) );
+    if( !index )
+        return NULL;
+    index->key = key;
+
+    dirp.dir_file     = dir;
+    dirp.dir_location = 0;
+    dirp.dir_current  = 0;
+    dirp.current_p    = 0;
+    dirp.dir_length   = dir->Length;
+
+    while( ( ret = UDFScanDirFID( device, &dirp, &filechar, &FileICB ) ) > 0 ) {
+        len = strlen( (char *)dirp.entry.d_name ) + 1;
+
+        if( index->count == entries_size ) {
+            entries_size = entries_size ? 2 * entries_size : 32;
+            p = realloc( index->entries, entries_size * sizeof( *entry ) );
+            if( !p )
+                break;
+            index->entries = p;
+        }
+        if( names_used + len > names_size ) {
+            names_size = names_size ? 2 * names_size : 1024;
+            while( names_used + len > names_size )
+                names_size *= 2;
+            p = realloc( index->names, names_size );
+            if( !p )
+                break;
+            index->names = p;
+        }
+
+        entry = &index->entries[ index->count++ ];
+        entry->hash = dir_index_fold( (char *)dirp.entry.d_name,
+                                      &index->names[ names_used ] );
+        entry->name = names_used;
+        entry->icb = FileICB;
+        names_used += len;
+    }
+
+    /* Don't remember a directory we only got part of */
+    if( ret != 0 ) {
+        dir_index_free( index );
+        return NULL;
+    }
+
+    for( size = 8; size < 2 * index->count; size <<= 1 )
+        ;
+    index->slots = malloc( size * sizeof( *index->slots ) );
+    if( !index->slots ) {
+        dir_index_free( index );
+        return NULL;
+    }
+    index->mask = size - 1;
+    for( i = 0; i < size; i++ )
+        index->slots[ i ] = -1;
+
+    for( i = 0; i < index->count; i++ ) {
+        entry = &index->entries[ i ];
+        for( slot = entry->hash & index->mask; index->slots[ slot ] >= 0;
+             slot = ( slot + 1 ) & index->mask ) {
+            struct udf_dir_entry *other = &index->entries[ index->slots[ slot ] ];
+            /* Same name twice: the scan would have stopped at the first */
+            if( other->hash == entry->hash &&
+                !strcmp( &index->names[ other->name ], &index->names[ entry->name ] ) )
+                break;
+        }
+        if( index->slots[ slot ] < 0 )
+            index->slots[ slot ] = i;
+    }
+
+    return index;
+}
 
+/* Index of directory dir, built on first use. NULL if it can't be had. */
+static udf_dir_index_t *dir_index_get( dvd_reader_t *device, udf_file_t *dir )
+{
+    uint32_t key = dir_index_key( device, dir );
+    udf_dir_index_t **bucket = &device->dir_index[ key % UDF_DIR_INDEX_BUCKETS ];
+    udf_dir_index_t *index;
+
+    for( index = *bucket; index != NULL; index = index->next )
+        if( index->key == key )
+            return index;
+
+    index = dir_index_build( device, dir, key );
+    if( index ) {
+        index->next = *bucket;
+        *bucket = index;
+    }
+    return index;
+}
+
+/**
+ * Looks up name in directory dir, case-insensitively, and maps the ICB of
+ * the match into File. dir and File may be the same.
+ * Returns 1 if found, 0 otherwise.
+ */
+static int UDFFindEntry( dvd_reader_t *device, udf_file_t *dir,
+                         const char *name, udf_file_t *File )
+{
+    char folded[ MAX_UDF_FILE_NAME_LEN ];
+    udf_dir_index_t *index = NULL;
+    struct udf_dir_entry *entry;
+    struct AD FileICB;
+    dvd_dir_t dirp;
+    uint32_t hash, slot;
+    uint8_t filechar, filetype;
+    int found = 0;
+
+    if( device->udfcache_level )
+        index = dir_index_get( device, dir );
+
+    if( index ) {
+        hash = dir_index_fold( name, folded );
+        for( slot = hash & index->mask; index->slots[ slot ] >= 0;
+             slot = ( slot + 1 ) & index->mask ) {
+            entry = &index->entries[ index->slots[ slot ] ];
+            if( entry->hash == hash && !strcmp( &index->names[ entry->name ], folded ) ) {
+                FileICB = entry->icb;
+                found = 1;
+                break;
+            }
+        }
+    } else {
+        /* No index (cache off, or out of memory): scan, but only map the match */
+        dirp.dir_file     = dir;
+        dirp.dir_location = 0;
+        dirp.dir_current  = 0;
+        dirp.current_p    = 0;
+        dirp.dir_length   = dir->Length;
+
+        while( UDFScanDirFID( device, &dirp, &filechar, &FileICB ) > 0 ) {
+            if( !strcasecmp( name, (char *)dirp.entry.d_name ) ) {
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    if( !found )
+        return 0;
+
+    return UDFMapICB( device, FileICB, &filetype, &device->partition, File );
+}
 
 udf_file_t *UDFFindFile( dvd_reader_t *device, char *filename,
                          uint64_t *filesize )
@@ -1149,8 +1908,7 @@ udf_file_t *UDFFindFile( dvd_reader_t *device, char *filename,
     udf_file_t *result;
     udf_file_t subdir;
     char tokenline[ MAX_UDF_FILE_NAME_LEN ];
-    char *token;
-    dvd_dir_t dirp;
+    char *token, *next;
 
 #ifdef DEBUG
     fprintf(stderr, "UDFFindFile('%s')\r\n", filename);
@@ -1158,37 +1916,32 @@ udf_file_t *UDFFindFile( dvd_reader_t *device, char *filename,
 
     tokenline[0] = '\0';
     strncat(tokenline, filename, MAX_UDF_FILE_NAME_LEN - 1);
+    memset(&subdir, 0, sizeof(subdir));
 
     // If it is Root, we have it already
     finder = &device->RootDirectory;
 
-    // Traverse tree..
-    token = strtok(tokenline, "/");
-
-    while( token != NULL ) {
-        int found = 0;
+    // Traverse tree.. Split by hand: strtok() keeps its place in a static,
+    // and separate readers may look files up from several threads at once
+    for( token = tokenline; token != NULL; token = next ) {
+        while( *token == '/' )
+            token++;
+        if( *token == '\0' )
+            break;
+        next = strchr( token, '/' );
+        if( next )
+            *next++ = '\0';
 
 #ifdef DEBUG
-        fprintf(stderr, "FindFile() calling ScanDir('%s')\r\n", token);
+        fprintf(stderr, "FindFile() calling FindEntry('%s')\r\n", token);
 #endif
 
-        dirp.dir_file = finder; // Start at root
-        dirp.dir_location = 0;// untranslated +0. ScanDir translated
-        dirp.dir_current  = 0;
-        dirp.current_p    = 0;
-        dirp.dir_length   = finder->Length;
-
-        while (UDFScanDirX(device, &dirp)) {
-            if( !strcasecmp( token, (char *)dirp.entry.d_name ) ) {
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found) {
+        // Maps the match into subdir, which may be the directory searched
+        if( !UDFFindEntry( device, finder, token, &subdir ) ) {
 #ifdef DEBUG
             fprintf(stderr, "FindFile not found, returning failure\r\n");
 #endif
+            UDFFileClear(&subdir);
             return NULL;
         }
 
@@ -1196,25 +1949,27 @@ udf_file_t *UDFFindFile( dvd_reader_t *device, char *filename,
         fprintf(stderr, "FindFile() located ('%s')\r\n", token);
 #endif
 
-        // Keep a copy of this subdir
-        // copy from dirp, since it will be overwritten if we descend...
-        memcpy(&subdir, &dirp.entry.dir_file, sizeof(subdir));
         finder = &subdir;
-
-        token = strtok( NULL, "/" );
     } // while slashes in path
 
 
-    dirp.dir_length   = finder->Length;
     if (filesize)
         *filesize = finder->Length;
 
     // Allocate a UDF_FILE node for the API user
     result = (udf_file_t *) malloc(sizeof(*result));
-    if (!result) return NULL;
+    if (!result) {
+        UDFFileClear(&subdir);
+        return NULL;
+    }
 
-    // Copy over the information
-    memcpy(result, finder, sizeof(*result));
+    // Hand over the AD chain of subdir, the root keeps its own
+    if (finder == &subdir) {
+        memcpy(result, finder, sizeof(*result));
+    } else if (!UDFFileCopy(result, finder)) {
+        free(result);
+        return NULL;
+    }
 
 #ifdef DEBUG
     fprintf(stderr, "Returning result OK with partition.Start at %d (length %d), num AD chains %d, and first AD chain.Location %d with AD chain.partition %d\r\n",
@@ -1248,6 +2003,8 @@ int UDFOpen( dvd_reader_t *device )
 {
     uint8_t LogBlock_base[ DVD_VIDEO_LB_LEN + 2048 ];
     uint8_t *LogBlock = (uint8_t *)(((uintptr_t)LogBlock_base & ~((uintptr_t)2047)) + 2048);
+    const uint8_t *data;
+    int entry = CACHE_EMPTY;
     uint32_t lbnum;
     uint16_t TagID;
     struct AD RootICB;
@@ -1259,6 +2016,12 @@ int UDFOpen( dvd_reader_t *device )
 
     fprintf(stderr, "UDFOpen\r\n");
 #endif
+    /* Everything holding an AD chain starts out empty, see UDFClose() */
+    memset(&File, 0, sizeof(File));
+    memset(&RootICB, 0, sizeof(RootICB));
+    memset(&device->RootDirectory, 0, sizeof(device->RootDirectory));
+    memset(&device->partition, 0, sizeof(device->partition));
+
     /* Find partition, 0 is the standard location for DVD Video.*/
     if( !UDFFindPartition( device, 0, &device->partition ) ) return 0;
 
@@ -1274,10 +2037,12 @@ int UDFOpen( dvd_reader_t *device )
 #endif
 
     do {
-        if( DVDReadLBUDFCached( device, lbnum++, 1, LogBlock, 0 ) <= 0 )
+        /* Hand back the previous block; every exit from the body lands here */
+        cache_put( device, entry );
+        if( ( data = cache_get( device, lbnum++, LogBlock, &entry ) ) == NULL )
             TagID = 0;
         else
-            UDFDescriptor( LogBlock, &TagID );
+            UDFDescriptor( data, &TagID );
 
 #ifdef DEBUG
         fprintf(stderr, "   loop1 TagID %d\r\n",
@@ -1286,7 +2051,7 @@ int UDFOpen( dvd_reader_t *device )
 
         if (TagID == 264) { // TAGID_SPACE_BITMAP
             struct space_bitmap bitmap;
-            UDFSpaceBitmap(LogBlock, &bitmap);
+            UDFSpaceBitmap(data, &bitmap);
 #ifdef DEBUG
             fprintf(stderr, "Found 264: SPACE_BITMAP: bits %u bytes %u. %08X %08X\r\n",
                     bitmap.NumberOfBits, bitmap.NumberOfBytes,
@@ -1297,7 +2062,7 @@ int UDFOpen( dvd_reader_t *device )
 
         if( TagID == 266 ) {
 
-            UDFExtFileEntry( LogBlock, &filetype, &device->partition, &File );
+            UDFExtFileEntry( device, data, &filetype, &device->partition, &File );
 
 #ifdef DEBUG
             fprintf(stderr, "TagID %d with filetype %d\r\n",
@@ -1317,13 +2082,17 @@ int UDFOpen( dvd_reader_t *device )
                         device->partition.Start + File.AD_chain[0].Location
                         );
 #endif
+                if (!File.num_AD)
+                    continue;
                 lbnum = device->partition.Start + File.AD_chain[0].Location;
 #ifdef DEBUG
                 fprintf(stderr, "Now Scanning from %d\r\n", lbnum);
 #endif
                 //device->partition.Metadata_Main = lbnum-1;
                 // Save the Metadata file so we can reference it
+                UDFFileClear(&device->partition.Metadata_Mainfile);
                 memcpy(&device->partition.Metadata_Mainfile, &File, sizeof(File));
+                memset(&File, 0, sizeof(File)); // The chain moved with it
                 continue;
             }
 
@@ -1336,7 +2105,9 @@ int UDFOpen( dvd_reader_t *device )
 #endif
                 //partition.Metadata_Mirror = lbnum-1;
                 // Save the Metadata file so we can reference it
+                UDFFileClear(&device->partition.Metadata_Mirrorfile);
                 memcpy(&device->partition.Metadata_Mirrorfile,&File, sizeof(File));
+                memset(&File, 0, sizeof(File)); // The chain moved with it
                 continue;
             }
 
@@ -1355,10 +2126,12 @@ int UDFOpen( dvd_reader_t *device )
 
         /* File Set Descriptor */
         if( TagID == 256 )  /* File Set Descriptor */
-            UDFGetRootICB(LogBlock, &RootICB);
+            UDFGetRootICB(data, &RootICB);
 
     } while( ( lbnum < device->partition.Start + device->partition.Length )
              && ( TagID != 8 ) && ( TagID != 256 ) );
+    cache_put( device, entry );
+    UDFFileClear( &File );
 
 #ifdef DEBUG
     fprintf(stderr, "  stopped first loop at %d TagID %d\r\n", lbnum-1, TagID);
@@ -1415,7 +2188,8 @@ int UDFOpen( dvd_reader_t *device )
 #endif
 
     /* Sanity check. */
-    if( device->RootDirectory.AD_chain[0].Partition != 0 ) {
+    if( device->RootDirectory.num_AD &&
+        device->RootDirectory.AD_chain[0].Partition != 0 ) {
 #ifdef DEBUG
         fprintf(stderr, "ADChain partition is not 0 (%d).\r\n",
                 device->RootDirectory.AD_chain[0].Partition);
@@ -1432,6 +2206,8 @@ int UDFOpen( dvd_reader_t *device )
 
         fprintf(stderr, "\r\n\r\n\r\nTESTING OPENDIR ON /\r\n");
 
+        memset(&dirp, 0, sizeof(dirp));
+        memset(&subdir, 0, sizeof(subdir));
         dirp.dir_location = 0;// untranslated +0. ScanDir translated
         dirp.dir_current  = 0;
         dirp.dir_length   = device->RootDirectory.Length;
@@ -1446,7 +2222,7 @@ int UDFOpen( dvd_reader_t *device )
             if (first) {
                 first--;
                 if (!first) {
-                    memcpy(&subdir, &dirp.entry.dir_file, sizeof(subdir));
+                    UDFFileCopy(&subdir, &dirp.entry.dir_file);
                     fprintf(stderr, "Copying first SUBDIR: Location %d num_AD %d. info_loc %d\r\n",
                             subdir.AD_chain[0].Location, subdir.num_AD,
                             subdir.info_location);
@@ -1467,6 +2243,9 @@ int UDFOpen( dvd_reader_t *device )
 
         }
 
+        UDFFileClear(&subdir);
+        UDFFileClear(&dirp.entry.dir_file);
+
     }
 #endif
 
@@ -1474,6 +2253,16 @@ int UDFOpen( dvd_reader_t *device )
     return 1;
 }
 
+/**
+ * Releases what UDFOpen() allocated. Safe after a failed UDFOpen().
+ */
+void UDFClose( dvd_reader_t *device )
+{
+    UDFFileClear( &device->RootDirectory );
+    UDFFileClear( &device->partition.Metadata_Mainfile );
+    UDFFileClear( &device->partition.Metadata_Mirrorfile );
+}
+
 
 
 /**
@@ -57,6 +57,20 @@ extern "C" {
 
 
 
+/**
+ * Initializes the input layer (and loads libdvdcss, if present) up front.
+ *
+ * DVDOpen() does this on first use, so calling it is optional. Programs
+ * that open readers from several threads may call it once beforehand so
+ * that the libdvdcss probe happens, and is reported, only once. Each
+ * thread must use its own dvd_reader_t.
+ *
+ * @return 1 if libdvdcss is used for DVD access, 0 otherwise.
+ *
+ * DVDInit();
+ */
+int DVDInit( void );
+
 /**
  * Opens a block device of a DVD-ROM file, or an image file, or a directory
  * name for a mounted DVD or HD copy of a DVD.
@@ -81,6 +95,37 @@ extern "C" {
  */
 dvd_reader_t *DVDOpen( const char * );
 
+/**
+ * DVDOpen() flag: map an image file into memory whole, so that
+ * DVDMapBlocks() can hand out its blocks in place and reads are copies from
+ * memory.  A media error, or the file being truncated while it is open, then
+ * raises SIGBUS in the caller instead of failing the read.  Ignored for block
+ * devices, directory trees, with libdvdcss, and together with DVD_OPEN_DIRECT.
+ */
+#define DVD_OPEN_MAP 0x1
+
+/**
+ * DVDOpen() flag: read the image or device with O_DIRECT, bypassing the page
+ * cache, for bulk copies that should not push everything else out of memory.
+ * Reads that are not 4 KiB aligned go through internal bounce buffers.
+ * Ignored for directory trees, with libdvdcss, and where O_DIRECT is not
+ * supported.
+ */
+#define DVD_OPEN_DIRECT 0x2
+
+/**
+ * Opens a block device of a DVD-ROM file, or an image file, or a directory
+ * name for a mounted DVD or HD copy of a DVD, like DVDOpen(), with DVD_OPEN_*
+ * flags.
+ *
+ * @param path Specifies the the device, file or directory to be used.
+ * @param flags DVD_OPEN_* flags, or 0.
+ * @return If successful a a read handle is returned. Otherwise 0 is returned.
+ *
+ * dvd = DVDOpenFlags(path, DVD_OPEN_DIRECT);
+ */
+dvd_reader_t *DVDOpenFlags( const char *, int );
+
 /**
  * Closes and cleans up the DVD reader object.
  *
@@ -162,6 +207,10 @@ void DVDCloseFile( dvd_file_t * );
  * When reading from an encrypted drive, blocks are decrypted using libdvdcss
  * where required.
  *
+ * Reads of unencrypted images keep no shared position, so threads may call
+ * this at once on different file handles of the same dvd_reader_t.  Opening
+ * and closing files must still be serialised by the caller.
+ *
  * @param dvd_file  A file read handle.
  * @param offset Block offset from the start of the file to start reading at.
  * @param block_count Number of block to read.
@@ -172,6 +221,103 @@ void DVDCloseFile( dvd_file_t * );
  */
 ssize_t DVDReadBlocks( dvd_file_t *, int, size_t, unsigned char * );
 
+/**
+ * Like DVDReadBlocks(), but returns the blocks in place instead of copying
+ * them, when the image file is mapped in memory (opened with DVD_OPEN_MAP).
+ * *block_count is lowered to what is contiguous on disc from offset, the end
+ * of the extent.  Returns NULL when the blocks can't be mapped (not a mapped
+ * image file, or past the end); DVDReadBlocks() works in every case.  The
+ * pointer stays valid until DVDClose().
+ *
+ * @param dvd_file  A file read handle.
+ * @param offset Block offset from the start of the file.
+ * @param block_count In: blocks wanted, out: blocks available at the pointer.
+ * @return The blocks, or NULL.
+ *
+ * data = DVDMapBlocks(dvd_file, offset, &block_count);
+ */
+const unsigned char *DVDMapBlocks( dvd_file_t *, int, size_t * );
+
+/**
+ * Writes byte_count bytes of the file, from block offset on, to the file
+ * descriptor fd without copying them through the caller: the kernel moves
+ * them from the image with copy_file_range() or sendfile().  Returns -1 when
+ * that is not possible (not an unencrypted image file, or fd doesn't take
+ * it) and nothing was written, so the caller can read and write instead.
+ * Otherwise returns the bytes written, fewer than byte_count at the end of
+ * the file or when a copy failed midway; the caller carries on from there.
+ *
+ * @param dvd_file  A file read handle.
+ * @param offset Block offset from the start of the file.
+ * @param byte_count Number of bytes to write.
+ * @param fd Descriptor to write to, at its current position.
+ * @return Bytes written, or -1.
+ *
+ * bytes = DVDCopyBlocks(dvd_file, offset, byte_count, fd);
+ */
+ssize_t DVDCopyBlocks( dvd_file_t *, int, size_t, int );
+
+/**
+ * Opaque type for a queue of asynchronous block reads, see DVDOpenReadQueue().
+ */
+typedef struct dvd_read_queue_s dvd_read_queue_t;
+
+/**
+ * Opens a queue that keeps block reads of the files of one reader in flight
+ * while the caller works, up to depth of them.  A read counts once per disc
+ * extent it touches.  On Linux the reads of an unencrypted image are issued
+ * through io_uring; elsewhere, and for encrypted discs or directory trees,
+ * each read completes as it is queued.
+ *
+ * @param dvd  A read handle.
+ * @param depth Maximum number of reads in flight.
+ * @return The queue, or NULL on failure.
+ *
+ * queue = DVDOpenReadQueue(dvd, 32);
+ */
+dvd_read_queue_t *DVDOpenReadQueue( dvd_reader_t *, int );
+
+/**
+ * Queues a read of block_count blocks at block offset of a file, as with
+ * DVDReadBlocks().  The buffer must be left alone until the read is reaped.
+ *
+ * @param queue  The queue.
+ * @param dvd_file  A file read handle.
+ * @param offset Block offset from the start of the file to start reading at.
+ * @param block_count Number of block to read.
+ * @param data Pointer to a buffer to write the data into.
+ * @param tag  Non-NULL value handed back by DVDReapReadBlocks().
+ * @return 0 if queued, -1 when the queue is full (reap first) or on error.
+ *
+ * ret = DVDQueueReadBlocks(queue, dvd_file, offset, block_count, data, tag);
+ */
+int DVDQueueReadBlocks( dvd_read_queue_t *, dvd_file_t *, int, size_t,
+                        unsigned char *, void * );
+
+/**
+ * Returns a completed read, in no particular order.  Sets *tag to the tag it
+ * was queued with, and returns the blocks it read or -1 on error.  When no
+ * read is in flight, or wait is 0 and none has completed, sets *tag to NULL
+ * and returns 0.
+ *
+ * @param queue  The queue.
+ * @param tag  Where to store the tag of the read.
+ * @param wait Whether to wait for a read still in flight.
+ * @return Blocks read, or -1 on error.
+ *
+ * blocks_read = DVDReapReadBlocks(queue, &tag, 1);
+ */
+ssize_t DVDReapReadBlocks( dvd_read_queue_t *, void **, int );
+
+/**
+ * Waits for the reads still in flight and frees the queue.
+ *
+ * @param queue  The queue.
+ *
+ * DVDCloseReadQueue(queue);
+ */
+void DVDCloseReadQueue( dvd_read_queue_t * );
+
 /**
  * Seek to the given position in the file.  Returns the resulting position in
  * bytes from the beginning of the file.  The seek position is only used for
@@ -235,6 +381,22 @@ uint64_t DVDFileSize64( dvd_file_t * );
  */
 int DVDDiscID( dvd_reader_t *, unsigned char * );
 
+/**
+ * Get the disc IDs of several discs at once, the same as DVDDiscID() gives
+ * for each.  The MD5 sums of up to eight discs are computed side by side
+ * in the lanes of the CPU's vector registers, chosen at run time.
+ *
+ * @param dvd The read handles, count of them.
+ * @param count Number of read handles.
+ * @param discid Room for count disc IDs, 16 bytes each, in the order of dvd.
+ * @param status NULL, or count results: 0, or -1 where DVDDiscID() would
+ *               fail for that disc.
+ * @return 0 if every disc ID was computed, -1 otherwise.
+ *
+ * ret = DVDDiscIDs(dvds, count, discids, status);
+ */
+int DVDDiscIDs( dvd_reader_t **, int, unsigned char *, int * );
+
 /**
  * Get the UDF VolumeIdentifier and VolumeSetIdentifier
  * from the PrimaryVolumeDescriptor.
@@ -296,6 +458,19 @@ int DVDISOVolumeInfo( dvd_reader_t *, char *, unsigned int,
  */
 int DVDUDFCacheLevel( dvd_reader_t *, int );
 
+/**
+ * Sets the number of 2048 byte blocks the UDF cache can hold. Blocks are
+ * looked up through a hash index and evicted least recently used first
+ * (CLOCK approximation). Resizing drops the current cache content.
+ *
+ * @param dvd A read handle.
+ * @param blocks Capacity in blocks, -1 returns the current setting, 0
+ *               frees the cache (equivalent to cache level 0).
+ *
+ * @return The capacity of the cache, in blocks.
+ */
+int DVDUDFCacheSize( dvd_reader_t *, int );
+
 /**
  * Open a Directory on UDF filesystem and retrieve contents, simulating
  * standard POSIX opendir().
@@ -307,6 +482,20 @@ int DVDUDFCacheLevel( dvd_reader_t *, int );
  */
 dvd_dir_t    *DVDOpenDir     ( dvd_reader_t *, char *);
 
+/**
+ * Open a Directory like DVDOpenDir(), with flags. With DVD_DIR_NAMES_ONLY,
+ * DVDReadDir() returns names and types straight from the directory without
+ * reading each entry's File Entry, which makes listing and walking a tree
+ * much cheaper; DVDStatDirent() fills in the size when it is wanted.
+ *
+ * @param dvd A read handle
+ * @param name directory name to iterate
+ * @param flags 0 or DVD_DIR_NAMES_ONLY
+ *
+ * @return A dvd_dir_t pointer to be used with DVDReadDir() and DVDCloseDir()
+ */
+dvd_dir_t    *DVDOpenDirFlags( dvd_reader_t *, char *, int );
+
 /**
  * Read contents of a dvd_dir_t, previously opened with DVDOpenDir(). Simulating
  * standard POSIX readdir().
@@ -318,6 +507,17 @@ dvd_dir_t    *DVDOpenDir     ( dvd_reader_t *, char *);
  */
 dvd_dirent_t *DVDReadDir     ( dvd_reader_t *, dvd_dir_t *);
 
+/**
+ * Fill in d_filesize and the extents of the entry DVDReadDir() last returned,
+ * for directories opened with DVD_DIR_NAMES_ONLY. A no-op otherwise.
+ *
+ * @param dvd A read handle
+ * @param dvd_dir_t An opened dir handle
+ *
+ * @return The completed entry, or NULL on read error.
+ */
+dvd_dirent_t *DVDStatDirent  ( dvd_reader_t *, dvd_dir_t *);
+
 /**
  * Close and free a previously opened dvd_dir_t handle. Simulating
  * standard POSIX closedir().
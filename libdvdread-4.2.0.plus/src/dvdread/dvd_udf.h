@@ -46,17 +46,13 @@ extern "C" {
  * It could be worth a separate struct for Directories, since they are (probably)
  * only ever in 1 chain.
  *
- * Is there a real max number of chains? What can fit in 2048?
- * My 4.4GB file example uses 5 chains. A BD ISO can store 50GB of data, so
- * potentially we could have a 50GB file, so we would need to be able to
- * support 62 chains.
+ * There is no real max number of chains: what doesn't fit in the 2048 byte
+ * File Entry continues in Allocation Extent Descriptors. So the chain is
+ * allocated to size and owned by its UDF_FILE; UDFFileClear() releases it,
+ * and plain struct copies share it.
  *
  */
 
-#ifndef UDF_MAX_AD_CHAINS     // Allow MAX to be increased by API.
-#define UDF_MAX_AD_CHAINS 50
-#endif
-
 
 /**
  * The length of one Logical Block of a DVD.
@@ -117,7 +113,8 @@ struct UDF_FILE {
     //uint32_t Partition_Start;
     uint16_t flags; // From ICBTAG
     uint32_t content_offset; // When flags&7==3
-    struct AD AD_chain[UDF_MAX_AD_CHAINS]; // Location(s) of the file data/content
+    struct AD *AD_chain; // num_AD location(s) of the file data/content
+    uint32_t *AD_block;  // File block each AD_chain entry starts at
     uint32_t info_location;                // Location of the 260/266 FileInfo
 };
 
@@ -251,15 +248,27 @@ typedef struct {
   unsigned int current_p; /* Internal implementation specific. UDFScanDirX */
   dvd_dirent_t entry;
   struct UDF_FILE *dir_file;         /* The AD_chain of the listing directory */
+  int flags;              /* DVD_DIR_* from DVDOpenDirFlags() */
+  int entry_mapped;       /* entry.dir_file and d_filesize are filled in */
+  struct AD entry_icb;    /* Where the entry's File Entry is, to map later */
 } dvd_dir_t;
 
+/* DVDReadDir only decodes the FIDs: d_name and d_type are set, d_filesize
+ * and dir_file are not until DVDStatDirent() is called on the entry. */
+#define DVD_DIR_NAMES_ONLY 0x1
+
 struct udf_cache_s {
     uint32_t lbnumber;
-    unsigned char data[DVD_VIDEO_LB_LEN];
+    uint8_t  valid;
+    uint8_t  referenced; // CLOCK reference bit, set on every hit
+    uint16_t pins;       // Borrowers holding a pointer to the block
 };
 typedef struct udf_cache_s udf_cache_t;
 
-#define NUM_UDF_CACHE 256 // x2 KB in memory use.
+#define NUM_UDF_CACHE 256 // Default number of blocks, x2 KB in memory use.
+
+typedef struct udf_dir_index_s udf_dir_index_t; // Names of a directory, see UDFFindFile
+#define UDF_DIR_INDEX_BUCKETS 32
 
 struct dvd_reader_s {
   /* Basic information. */
@@ -278,8 +287,14 @@ struct dvd_reader_s {
 
   /* Filesystem cache */
   int udfcache_level; /* 0 - turned off, 1 - on */
-  int cache_index;
-  udf_cache_t udf_cache[NUM_UDF_CACHE];
+  int cache_size;      /* Number of blocks held, see DVDUDFCacheSize() */
+  int cache_hand;      /* CLOCK hand, next eviction candidate */
+  udf_cache_t *udf_cache;
+  int32_t *cache_hash;      /* lbnumber -> udf_cache entry, -1 when empty */
+  uint32_t cache_hash_mask; /* Hash table size - 1, a power of two */
+  unsigned char *cache_data; /* cache_size blocks, 2048 aligned */
+  unsigned char *cache_data_base;
+  udf_dir_index_t *dir_index[UDF_DIR_INDEX_BUCKETS]; /* Built on lookup */
 
   struct Partition partition;
   struct MetadataPartition meta_partition;
@@ -308,9 +323,12 @@ udf_file_t *UDFFindFile(
                         char *filename,
                         uint64_t *size );
 void        UDFFreeFile( dvd_reader_t *device, udf_file_t *udf_file );
+void        UDFFileClear( udf_file_t *udf_file );
 uint32_t    UDFFileBlockDir( dvd_reader_t *device, udf_file_t *udf_file, uint32_t file_block);
 uint32_t    UDFFileBlockFile( dvd_reader_t *device, udf_file_t *udf_file, uint32_t file_block);
+uint32_t    UDFFileBlockFileRun( dvd_reader_t *device, udf_file_t *udf_file, uint32_t file_block, uint32_t *count);
 int         UDFScanDirX( dvd_reader_t *device, dvd_dir_t *dirp );
+int         UDFMapDirent( dvd_reader_t *device, dvd_dir_t *dirp );
 void FreeUDFCache(void *cache);
 int UDFGetVolumeIdentifier(dvd_reader_t *device,
                            char *volid, unsigned int volid_size);
@@ -319,6 +337,10 @@ int UDFGetVolumeSetIdentifier(dvd_reader_t *device,
 void *GetUDFCacheHandle(dvd_reader_t *device);
 void SetUDFCacheHandle(dvd_reader_t *device, void *cache);
 int UDFOpen( dvd_reader_t *device );
+void UDFClose( dvd_reader_t *device );
+int UDFCacheInit( dvd_reader_t *device, int blocks );
+void UDFCacheFree( dvd_reader_t *device );
+void UDFDirIndexFree( dvd_reader_t *device );
 
 #ifdef __cplusplus
 };
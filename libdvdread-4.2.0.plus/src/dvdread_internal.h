@@ -37,5 +37,7 @@
 
 int UDFReadBlocksRaw(dvd_reader_t *device, uint32_t lb_number,
                      size_t block_count, unsigned char *data, int encrypted);
+const unsigned char *UDFMapBlocksRaw(dvd_reader_t *device, uint32_t lb_number,
+                                     size_t block_count);
 
 #endif /* LIBDVDREAD_DVDREAD_INTERNAL_H */
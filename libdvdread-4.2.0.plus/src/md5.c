@@ -405,3 +405,274 @@ md5_process_block (buffer, len, ctx)
   ctx->C = C;
   ctx->D = D;
 }
+
+
+/* Several streams at once: each 32-bit lane of a vector register carries
+   the state of its own stream, so one pass over the 64 steps advances a
+   block of every stream.  GCC's generic vectors are compiled per target,
+   SSE2 for 4 lanes and AVX2 for 8, and md5_lanes picks one at run time.  */
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) \
+        || defined __clang__)
+# define MD5_SIMD 1
+#endif
+
+#ifdef MD5_SIMD
+
+#include <immintrin.h>
+
+typedef md5_uint32 md5_v4 __attribute__ ((vector_size (16)));
+typedef md5_uint32 md5_v8 __attribute__ ((vector_size (32)));
+
+/* Load the next block of each lane with X[k] holding word k of every
+   lane: rows of words from each lane, transposed in registers.  */
+static inline void __attribute__ ((target ("sse2")))
+md5_load_sse2 (md5_v4 *X, const void **buffer, size_t offset)
+{
+  const __m128i *p0 = (const void *) ((const char *) buffer[0] + offset);
+  const __m128i *p1 = (const void *) ((const char *) buffer[1] + offset);
+  const __m128i *p2 = (const void *) ((const char *) buffer[2] + offset);
+  const __m128i *p3 = (const void *) ((const char *) buffer[3] + offset);
+  __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+  int k;
+
+  for (k = 0; k < 16; k += 4)
+    {
+      r0 = _mm_loadu_si128 (p0++);
+      r1 = _mm_loadu_si128 (p1++);
+      r2 = _mm_loadu_si128 (p2++);
+      r3 = _mm_loadu_si128 (p3++);
+      t0 = _mm_unpacklo_epi32 (r0, r1);
+      t1 = _mm_unpacklo_epi32 (r2, r3);
+      t2 = _mm_unpackhi_epi32 (r0, r1);
+      t3 = _mm_unpackhi_epi32 (r2, r3);
+      X[k] = (md5_v4) _mm_unpacklo_epi64 (t0, t1);
+      X[k + 1] = (md5_v4) _mm_unpackhi_epi64 (t0, t1);
+      X[k + 2] = (md5_v4) _mm_unpacklo_epi64 (t2, t3);
+      X[k + 3] = (md5_v4) _mm_unpackhi_epi64 (t2, t3);
+    }
+}
+
+static inline void __attribute__ ((target ("avx2")))
+md5_load_avx2 (md5_v8 *X, const void **buffer, size_t offset)
+{
+  __m256i r[8], t[8], u[8];
+  int i, k;
+
+  for (k = 0; k < 16; k += 8)
+    {
+      for (i = 0; i < 8; i++)
+        r[i] = _mm256_loadu_si256 ((const __m256i *)
+                                   ((const char *) buffer[i] + offset)
+                                   + k / 8);
+      for (i = 0; i < 8; i += 2)
+        {
+          t[i] = _mm256_unpacklo_epi32 (r[i], r[i + 1]);
+          t[i + 1] = _mm256_unpackhi_epi32 (r[i], r[i + 1]);
+        }
+      for (i = 0; i < 8; i += 4)
+        {
+          u[i] = _mm256_unpacklo_epi64 (t[i], t[i + 2]);
+          u[i + 1] = _mm256_unpackhi_epi64 (t[i], t[i + 2]);
+          u[i + 2] = _mm256_unpacklo_epi64 (t[i + 1], t[i + 3]);
+          u[i + 3] = _mm256_unpackhi_epi64 (t[i + 1], t[i + 3]);
+        }
+      /* Words 0-3 of lanes 0-3 and 4-7 are in the low halves.  */
+      for (i = 0; i < 4; i++)
+        {
+          X[k + i] = (md5_v8)
+            _mm256_permute2x128_si256 (u[i], u[i + 4], 0x20);
+          X[k + i + 4] = (md5_v8)
+            _mm256_permute2x128_si256 (u[i], u[i + 4], 0x31);
+        }
+    }
+}
+
+#undef OP
+#define OP(f, a, b, c, d, k, s, T)                      \
+      do                                                \
+        {                                               \
+          a += f (b, c, d) + X[k] + T;                  \
+          a = (a << s) | (a >> (32 - s));               \
+          a += b;                                       \
+        }                                               \
+      while (0)
+
+#define MD5_LANES(name, isa, vec, n, load)                               \
+static void __attribute__ ((target (isa)))                              \
+name (const void **buffer, size_t len, struct md5_ctx **ctx)            \
+{                                                                       \
+  md5_uint32 state[4][n];                                                \
+  vec A, B, C, D, A_save, B_save, C_save, D_save;                       \
+  vec X[16];                                                            \
+  size_t offset;                                                        \
+  int i;                                                                \
+                                                                        \
+  for (i = 0; i < n; i++)                                               \
+    {                                                                   \
+      state[0][i] = ctx[i]->A;                                          \
+      state[1][i] = ctx[i]->B;                                          \
+      state[2][i] = ctx[i]->C;                                          \
+      state[3][i] = ctx[i]->D;                                          \
+    }                                                                   \
+  memcpy (&A, state[0], sizeof (A));                                    \
+  memcpy (&B, state[1], sizeof (B));                                    \
+  memcpy (&C, state[2], sizeof (C));                                    \
+  memcpy (&D, state[3], sizeof (D));                                    \
+                                                                        \
+  for (offset = 0; offset < len; offset += 64)                          \
+    {                                                                   \
+      load (X, buffer, offset);                                         \
+                                                                        \
+      A_save = A;                                                       \
+      B_save = B;                                                       \
+      C_save = C;                                                       \
+      D_save = D;                                                       \
+                                                                        \
+      OP (FF, A, B, C, D,  0,  7, 0xd76aa478);                          \
+      OP (FF, D, A, B, C,  1, 12, 0xe8c7b756);                          \
+      OP (FF, C, D, A, B,  2, 17, 0x242070db);                          \
+      OP (FF, B, C, D, A,  3, 22, 0xc1bdceee);                          \
+      OP (FF, A, B, C, D,  4,  7, 0xf57c0faf);                          \
+      OP (FF, D, A, B, C,  5, 12, 0x4787c62a);                          \
+      OP (FF, C, D, A, B,  6, 17, 0xa8304613);                          \
+      OP (FF, B, C, D, A,  7, 22, 0xfd469501);                          \
+      OP (FF, A, B, C, D,  8,  7, 0x698098d8);                          \
+      OP (FF, D, A, B, C,  9, 12, 0x8b44f7af);                          \
+      OP (FF, C, D, A, B, 10, 17, 0xffff5bb1);                          \
+      OP (FF, B, C, D, A, 11, 22, 0x895cd7be);                          \
+      OP (FF, A, B, C, D, 12,  7, 0x6b901122);                          \
+      OP (FF, D, A, B, C, 13, 12, 0xfd987193);                          \
+      OP (FF, C, D, A, B, 14, 17, 0xa679438e);                          \
+      OP (FF, B, C, D, A, 15, 22, 0x49b40821);                          \
+                                                                        \
+      OP (FG, A, B, C, D,  1,  5, 0xf61e2562);                          \
+      OP (FG, D, A, B, C,  6,  9, 0xc040b340);                          \
+      OP (FG, C, D, A, B, 11, 14, 0x265e5a51);                          \
+      OP (FG, B, C, D, A,  0, 20, 0xe9b6c7aa);                          \
+      OP (FG, A, B, C, D,  5,  5, 0xd62f105d);                          \
+      OP (FG, D, A, B, C, 10,  9, 0x02441453);                          \
+      OP (FG, C, D, A, B, 15, 14, 0xd8a1e681);                          \
+      OP (FG, B, C, D, A,  4, 20, 0xe7d3fbc8);                          \
+      OP (FG, A, B, C, D,  9,  5, 0x21e1cde6);                          \
+      OP (FG, D, A, B, C, 14,  9, 0xc33707d6);                          \
+      OP (FG, C, D, A, B,  3, 14, 0xf4d50d87);                          \
+      OP (FG, B, C, D, A,  8, 20, 0x455a14ed);                          \
+      OP (FG, A, B, C, D, 13,  5, 0xa9e3e905);                          \
+      OP (FG, D, A, B, C,  2,  9, 0xfcefa3f8);                          \
+      OP (FG, C, D, A, B,  7, 14, 0x676f02d9);                          \
+      OP (FG, B, C, D, A, 12, 20, 0x8d2a4c8a);                          \
+                                                                        \
+      OP (FH, A, B, C, D,  5,  4, 0xfffa3942);                          \
+      OP (FH, D, A, B, C,  8, 11, 0x8771f681);                          \
+      OP (FH, C, D, A, B, 11, 16, 0x6d9d6122);                          \
+      OP (FH, B, C, D, A, 14, 23, 0xfde5380c);                          \
+      OP (FH, A, B, C, D,  1,  4, 0xa4beea44);                          \
+      OP (FH, D, A, B, C,  4, 11, 0x4bdecfa9);                          \
+      OP (FH, C, D, A, B,  7, 16, 0xf6bb4b60);                          \
+      OP (FH, B, C, D, A, 10, 23, 0xbebfbc70);                          \
+      OP (FH, A, B, C, D, 13,  4, 0x289b7ec6);                          \
+      OP (FH, D, A, B, C,  0, 11, 0xeaa127fa);                          \
+      OP (FH, C, D, A, B,  3, 16, 0xd4ef3085);                          \
+      OP (FH, B, C, D, A,  6, 23, 0x04881d05);                          \
+      OP (FH, A, B, C, D,  9,  4, 0xd9d4d039);                          \
+      OP (FH, D, A, B, C, 12, 11, 0xe6db99e5);                          \
+      OP (FH, C, D, A, B, 15, 16, 0x1fa27cf8);                          \
+      OP (FH, B, C, D, A,  2, 23, 0xc4ac5665);                          \
+                                                                        \
+      OP (FI, A, B, C, D,  0,  6, 0xf4292244);                          \
+      OP (FI, D, A, B, C,  7, 10, 0x432aff97);                          \
+      OP (FI, C, D, A, B, 14, 15, 0xab9423a7);                          \
+      OP (FI, B, C, D, A,  5, 21, 0xfc93a039);                          \
+      OP (FI, A, B, C, D, 12,  6, 0x655b59c3);                          \
+      OP (FI, D, A, B, C,  3, 10, 0x8f0ccc92);                          \
+      OP (FI, C, D, A, B, 10, 15, 0xffeff47d);                          \
+      OP (FI, B, C, D, A,  1, 21, 0x85845dd1);                          \
+      OP (FI, A, B, C, D,  8,  6, 0x6fa87e4f);                          \
+      OP (FI, D, A, B, C, 15, 10, 0xfe2ce6e0);                          \
+      OP (FI, C, D, A, B,  6, 15, 0xa3014314);                          \
+      OP (FI, B, C, D, A, 13, 21, 0x4e0811a1);                          \
+      OP (FI, A, B, C, D,  4,  6, 0xf7537e82);                          \
+      OP (FI, D, A, B, C, 11, 10, 0xbd3af235);                          \
+      OP (FI, C, D, A, B,  2, 15, 0x2ad7d2bb);                          \
+      OP (FI, B, C, D, A,  9, 21, 0xeb86d391);                          \
+                                                                        \
+      A += A_save;                                                      \
+      B += B_save;                                                      \
+      C += C_save;                                                      \
+      D += D_save;                                                      \
+    }                                                                   \
+                                                                        \
+  memcpy (state[0], &A, sizeof (A));                                    \
+  memcpy (state[1], &B, sizeof (B));                                    \
+  memcpy (state[2], &C, sizeof (C));                                    \
+  memcpy (state[3], &D, sizeof (D));                                    \
+  for (i = 0; i < n; i++)                                               \
+    {                                                                   \
+      ctx[i]->A = state[0][i];                                          \
+      ctx[i]->B = state[1][i];                                          \
+      ctx[i]->C = state[2][i];                                          \
+      ctx[i]->D = state[3][i];                                          \
+      ctx[i]->total[0] += len;                                          \
+      if (ctx[i]->total[0] < len)                                       \
+        ++ctx[i]->total[1];                                             \
+    }                                                                   \
+}
+
+MD5_LANES (md5_process_sse2, "sse2", md5_v4, 4, md5_load_sse2)
+MD5_LANES (md5_process_avx2, "avx2", md5_v8, 8, md5_load_avx2)
+
+#endif /* MD5_SIMD */
+
+int
+md5_lanes ()
+{
+#ifdef MD5_SIMD
+  if (__builtin_cpu_supports ("avx2"))
+    return 8;
+  if (__builtin_cpu_supports ("sse2"))
+    return 4;
+#endif
+  return 1;
+}
+
+void
+md5_process_lanes (buffer, len, ctx, lanes)
+     const void **buffer;
+     size_t len;
+     struct md5_ctx **ctx;
+     int lanes;
+{
+#ifdef MD5_SIMD
+  const void *group_buffer[MD5_MAX_LANES];
+  struct md5_ctx *group_ctx[MD5_MAX_LANES];
+  struct md5_ctx spare;
+  int width = md5_lanes ();
+  int i, n;
+
+  /* A lone stream is faster on its own; a short group is filled up with
+     repeats of its first lane, whose results go to a scratch context.  */
+  while (lanes > 1 && width > 1)
+    {
+      n = lanes < width ? lanes : width;
+      if (n <= 4)
+        width = 4;
+      spare = *ctx[0];
+      for (i = 0; i < width; i++)
+        {
+          group_buffer[i] = buffer[i < n ? i : 0];
+          group_ctx[i] = i < n ? ctx[i] : &spare;
+        }
+      if (width == 8)
+        md5_process_avx2 (group_buffer, len, group_ctx);
+      else
+        md5_process_sse2 (group_buffer, len, group_ctx);
+      buffer += n;
+      ctx += n;
+      lanes -= n;
+    }
+#endif
+
+  while (lanes-- > 0)
+    md5_process_block (*buffer++, len, *ctx++);
+}
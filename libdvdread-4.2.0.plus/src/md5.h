@@ -143,6 +143,19 @@ extern int md5_stream __P ((FILE *stream, void *resblock));
    digest.  */
 extern void *md5_buffer __P ((const char *buffer, size_t len, void *resblock));
 
+/* Most streams md5_process_lanes hashes side by side.  */
+#define MD5_MAX_LANES 8
+
+/* Number of streams md5_process_lanes can hash for the price of one on
+   this CPU: 8 with AVX2, 4 with SSE2, otherwise 1.  */
+extern int md5_lanes __P ((void));
+
+/* Like md5_process_block, for LANES independent streams at once: the
+   next LEN bytes at BUFFER[i] go into CTX[i].  LEN must be a multiple
+   of 64 and is the same for every lane.  */
+extern void md5_process_lanes __P ((const void **buffer, size_t len,
+                                    struct md5_ctx **ctx, int lanes));
+
 /* The following is from gnupg-1.0.2's cipher/bithelp.h.  */
 /* Rotate a 32 bit integer by n bytes */
 #if defined __GNUC__ && defined __i386__
@@ -1,26 +1,385 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <dvdread/dvd_reader.h>
+#include <dvdread/dvd_udf.h>
 
-int main(int argc, char *argv[]) {
+// Blocks per read
+#define READ_BLOCKS 512
+
+// Reads kept in flight unless -q says otherwise
+#define QUEUE_DEPTH 8
+
+// Reads kept in flight by each tree worker unless -q says otherwise
+#define TREE_QUEUE_DEPTH 2
+
+// count of a chunk whose read has not been reaped yet
+#define IN_FLIGHT (-2)
+
+// Chunk buffer alignment, enough for O_DIRECT
+#define ALIGN 4096
+
+struct chunk {
+	unsigned char *base;
+	unsigned char *data;
+	size_t bytes;
+	size_t blocks;
+	ssize_t count;
+};
+
+// Read queue and chunk buffers, one per thread extracting files
+struct extractor {
+	dvd_read_queue_t *queue;
+	struct chunk *chunks;
+	int depth;
+	int flags;
+};
+
+// A file found by the tree walk
+struct entry {
+	char *path;
+	char *dest;
+	uint32_t lb; // First block in the image, files are extracted in this order
+};
+
+// Tree mode: the walk fills entries, then workers take them in turn
+struct tree {
+	const char *image;
+	dvd_reader_t *device; // For the walk, each worker opens its own
+	struct entry *entries;
+	size_t count, alloc, next;
+	int depth, flags;
+	pthread_mutex_t lock;
+};
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-d] [-q depth] image filename\n", name);
+	fprintf(stderr, "       %s [-d] [-q depth] [-j jobs] -t destdir image [directory]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+void write_all(int fd, const char *dest, const unsigned char *data, size_t len) {
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, data, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			perror(dest);
+			exit(EXIT_FAILURE);
+		}
+		data += ret;
+		len -= ret;
+	}
+}
+
+void extractor_init(struct extractor *ex, dvd_reader_t *device, int depth, int flags) {
+	int i;
+
+	ex->queue = DVDOpenReadQueue(device, depth);
+	assert(ex->queue != NULL);
+
+	ex->chunks = calloc(depth, sizeof(*ex->chunks));
+	assert(ex->chunks != NULL);
+	for (i = 0; i < depth; i++) {
+		ex->chunks[i].base = malloc(READ_BLOCKS * DVD_VIDEO_LB_LEN + ALIGN);
+		assert(ex->chunks[i].base != NULL);
+		ex->chunks[i].data = (unsigned char *)(((uintptr_t)ex->chunks[i].base & ~((uintptr_t)ALIGN - 1)) + ALIGN);
+	}
+	ex->depth = depth;
+	ex->flags = flags;
+}
+
+void extractor_free(struct extractor *ex) {
+	int i;
+
+	DVDCloseReadQueue(ex->queue);
+	for (i = 0; i < ex->depth; i++)
+		free(ex->chunks[i].base);
+	free(ex->chunks);
+}
+
+// Write the whole of file to fd, named dest in errors
+void extract(struct extractor *ex, dvd_file_t *file, int fd, const char *dest) {
+	struct chunk *chunk;
+	uint64_t remaining;
+	ssize_t copied = -1;
+	size_t skip = 0;
+	unsigned int queued = 0, written = 0;
+	int depth = ex->depth;
+	int offset = 0;
+
+	// Let the kernel move the data from the image when it can, unless
+	// asked to keep it out of the page cache
+	remaining = DVDFileSize64(file);
+	if (!(ex->flags & DVD_OPEN_DIRECT))
+		copied = DVDCopyBlocks(file, 0, remaining, fd);
+	if ((uint64_t)copied == remaining) {
+		remaining = 0;
+	} else if (copied > 0) {
+		// Read what is left, from the block the copy stopped in
+		offset = copied / DVD_VIDEO_LB_LEN;
+		skip = copied % DVD_VIDEO_LB_LEN;
+		remaining -= (uint64_t)offset * DVD_VIDEO_LB_LEN;
+	}
+
+	// Keep up to depth chunks in flight, write them out in file order
+	while (written < queued || remaining > 0) {
+		while (remaining > 0 && queued < written + depth) {
+			chunk = &ex->chunks[queued % depth];
+			chunk->bytes = (remaining < READ_BLOCKS * DVD_VIDEO_LB_LEN) ? remaining : READ_BLOCKS * DVD_VIDEO_LB_LEN;
+			chunk->blocks = (chunk->bytes + DVD_VIDEO_LB_LEN - 1) / DVD_VIDEO_LB_LEN;
+			chunk->count = IN_FLIGHT;
+			if (DVDQueueReadBlocks(ex->queue, file, offset, chunk->blocks, chunk->data, chunk) < 0) {
+				// Queue full, make room first
+				assert(written < queued);
+				break;
+			}
+			offset += chunk->blocks;
+			remaining -= chunk->bytes;
+			queued++;
+		}
+
+		chunk = &ex->chunks[written % depth];
+		while (chunk->count == IN_FLIGHT) {
+			void *tag;
+			ssize_t count = DVDReapReadBlocks(ex->queue, &tag, 1);
+
+			assert(tag != NULL);
+			((struct chunk *)tag)->count = count;
+		}
+		assert(chunk->count == (ssize_t)chunk->blocks);
+
+		write_all(fd, dest, chunk->data + skip, chunk->bytes - skip);
+		skip = 0;
+		written++;
+	}
+}
+
+char *join(const char *dir, const char *name) {
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = malloc(len);
+
+	assert(path != NULL);
+	snprintf(path, len, "%s/%s", dir, name);
+	return path;
+}
+
+// Recreate the directories under dirname in dest, and list the files
+void walk_directory(struct tree *tree, const char *dirname, const char *dest) {
+	dvd_dir_t *dir;
+	dvd_dirent_t *dirent;
+	struct entry *entry;
+	char *path, *sub;
+
+	if (mkdir(dest, 0777) < 0 && errno != EEXIST) {
+		perror(dest);
+		exit(EXIT_FAILURE);
+	}
+
+	// File Entries are only read for files, through DVDStatDirent()
+	dir = DVDOpenDirFlags(tree->device, (char *)dirname, DVD_DIR_NAMES_ONLY);
+	assert(dir != NULL);
+
+	while ((dirent = DVDReadDir(tree->device, dir)) != NULL) {
+		path = join(dirname, (char *)dirent->d_name);
+		sub = join(dest, (char *)dirent->d_name);
+
+		switch (dirent->d_type) {
+			case DVD_DT_DIR:
+				walk_directory(tree, path, sub);
+				free(path);
+				free(sub);
+				break;
+			case DVD_DT_REG:
+				dirent = DVDStatDirent(tree->device, dir);
+				assert(dirent != NULL);
+				if (tree->count == tree->alloc) {
+					tree->alloc = tree->alloc ? tree->alloc * 2 : 64;
+					tree->entries = realloc(tree->entries, tree->alloc * sizeof(*tree->entries));
+					assert(tree->entries != NULL);
+				}
+				entry = &tree->entries[tree->count++];
+				entry->path = path;
+				entry->dest = sub;
+				entry->lb = UDFFileBlockFileRun(tree->device, &dirent->dir_file, 0, NULL);
+				break;
+			default:
+				fprintf(stderr, "Unhandled type %d for %s\n", dirent->d_type, path);
+				free(path);
+				free(sub);
+		}
+	}
+
+	DVDCloseDir(tree->device, dir);
+}
+
+int entry_cmp(const void *a, const void *b) {
+	const struct entry *x = a, *y = b;
+
+	return (x->lb > y->lb) - (x->lb < y->lb);
+}
+
+// Worker: take the next file in disc order until there are none left.
+// A reader is not safe to share between threads: with libdvdcss, its
+// title key switches with the file being read.
+void *tree_worker(void *arg) {
+	struct tree *tree = arg;
+	struct extractor ex;
+	struct entry *entry;
 	dvd_reader_t *device;
 	dvd_file_t *file;
-	ssize_t count;
+	int fd, ret;
 
-	assert(argc == 3);
-	device = DVDOpen(argv[1]);
+	device = DVDOpenFlags(tree->image, tree->flags);
 	assert(device != NULL);
+	extractor_init(&ex, device, tree->depth, tree->flags);
 
-	file = DVDOpenFilename(device, argv[2]);
-	assert(file != NULL);
+	for (;;) {
+		pthread_mutex_lock(&tree->lock);
+		if (tree->next == tree->count) {
+			pthread_mutex_unlock(&tree->lock);
+			break;
+		}
+		entry = &tree->entries[tree->next++];
+		pthread_mutex_unlock(&tree->lock);
+
+		file = DVDOpenFilename(device, entry->path);
+		assert(file != NULL);
+
+		fd = open(entry->dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0) {
+			perror(entry->dest);
+			exit(EXIT_FAILURE);
+		}
+		extract(&ex, file, fd, entry->dest);
+		ret = close(fd);
+		assert(ret == 0);
+
+		DVDCloseFile(file);
+	}
+
+	extractor_free(&ex);
+	DVDClose(device);
+
+	return NULL;
+}
+
+// Mirror the subtree at dirname into dest with jobs workers
+void extract_tree(const char *image, dvd_reader_t *device, const char *dirname, const char *dest, int jobs, int depth, int flags) {
+	struct tree tree;
+	pthread_t *workers;
+	char *root;
+	size_t len;
+	int ret, i;
+
+	memset(&tree, 0, sizeof(tree));
+	tree.image = image;
+	tree.device = device;
+	tree.depth = depth;
+	tree.flags = flags;
+	pthread_mutex_init(&tree.lock, NULL);
+
+	// The walk joins names with '/', so the root is ""
+	root = strdup(dirname);
+	assert(root != NULL);
+	len = strlen(root);
+	while (len > 0 && root[len - 1] == '/')
+		root[--len] = 0;
+
+	walk_directory(&tree, root, dest);
+	qsort(tree.entries, tree.count, sizeof(*tree.entries), entry_cmp);
 
-	unsigned char buffer[DVDFileSize64(file)];
+	if ((size_t)jobs > tree.count)
+		jobs = tree.count ? tree.count : 1;
+	workers = malloc(jobs * sizeof(*workers));
+	assert(workers != NULL);
 
-	count = DVDReadBytes(file, buffer, sizeof(buffer));
-	assert(count == sizeof(buffer));
+	for (i = 0; i < jobs; i++) {
+		ret = pthread_create(&workers[i], NULL, tree_worker, &tree);
+		assert(ret == 0);
+	}
+	for (i = 0; i < jobs; i++)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	while (tree.count > 0) {
+		tree.count--;
+		free(tree.entries[tree.count].path);
+		free(tree.entries[tree.count].dest);
+	}
+	free(tree.entries);
+	free(root);
+	pthread_mutex_destroy(&tree.lock);
+}
+
+int main(int argc, char *argv[]) {
+	dvd_reader_t *device;
+	dvd_file_t *file;
+	struct extractor ex;
+	char *dest = NULL;
+	int depth = 0;
+	int jobs = 0;
+	int flags = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "dj:q:t:")) != -1) {
+		switch (opt) {
+			case 'd':
+				// Stream past the page cache
+				flags |= DVD_OPEN_DIRECT;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1)
+					usage(argv[0]);
+				break;
+			case 'q':
+				depth = atoi(optarg);
+				if (depth < 1)
+					usage(argv[0]);
+				break;
+			case 't':
+				dest = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (dest == NULL ? argc - optind != 2 : (argc - optind < 1 || argc - optind > 2))
+		usage(argv[0]);
+
+	device = DVDOpenFlags(argv[optind], flags);
+	assert(device != NULL);
+
+	if (dest != NULL) {
+		// Whole subtree, the root by default
+		if (jobs == 0)
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs < 1)
+			jobs = 1;
+		extract_tree(argv[optind], device, (argc - optind == 2) ? argv[optind + 1] : "/", dest, jobs, depth ? depth : TREE_QUEUE_DEPTH, flags);
+		DVDClose(device);
+		return 0;
+	}
+
+	file = DVDOpenFilename(device, argv[optind + 1]);
+	assert(file != NULL);
 
-	fwrite(buffer, sizeof(buffer), 1, stdout);
+	extractor_init(&ex, device, depth ? depth : QUEUE_DEPTH, flags);
+	extract(&ex, file, STDOUT_FILENO, "stdout");
+	extractor_free(&ex);
 
 	DVDCloseFile(file);
 
@@ -1,8 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <openssl/evp.h>
 
@@ -11,7 +23,270 @@
 
 #include <jansson.h>
 
-#define HASH_NAME "SHA512"
+#include "blake3.h"
+#include "xxh3.h"
+
+#define DEFAULT_HASHES "SHA512"
+// With --all, a fast key comes along in the same pass
+#define DEFAULT_ALL_HASHES "SHA512,XXH3"
+
+// Digests taken in one pass at most; the first one gives hash_value
+#define MAX_HASHES 4
+
+// Fingerprint cache file: a fixed table of slots, then the records
+#define CACHE_MAGIC "UDFFPC05"
+#define CACHE_SLOTS 4096
+// Slots tried from the home slot before one is overwritten
+#define CACHE_PROBES 8
+// Records past this many bytes and the cache starts over
+#define CACHE_MAX_BYTES (64 << 20)
+
+// Blocks read per piece at most
+#define READ_BLOCKS 512
+
+// Blocks per batch; each ring slot holds one batch
+#define BATCH_BLOCKS 4096
+
+// Batches in flight between the reader thread and the digest
+#define RING_SLOTS 2
+
+// Reads the reader thread keeps in flight when the image isn't mapped
+#define QUEUE_DEPTH 16
+
+// Read buffer alignment, enough for O_DIRECT
+#define READ_ALIGN 4096
+#define ALIGN_BLOCKS (READ_ALIGN / DVD_VIDEO_LB_LEN)
+
+// A file to fingerprint
+struct target {
+	dvd_file_t *file;
+	char *path;
+	uint64_t size;
+	size_t first_piece, pieces; // Its pieces in the plan
+	unsigned char digests[MAX_HASHES][EVP_MAX_MD_SIZE]; // Its own, with --files
+};
+
+// Part of a file that is contiguous in the image, read and hashed in one go
+struct piece {
+	dvd_file_t *file;
+	size_t target;         // Index of its file in the plan
+	int offset;            // Block offset in the file
+	uint32_t lb;           // Where it starts in the image
+	size_t blocks;
+	size_t len;            // Bytes to hash
+	unsigned char *buffer; // Where it is read to, within its slot
+};
+
+// Every piece of every target file, in the order they are hashed
+struct plan {
+	struct piece *pieces;
+	size_t count, alloc;
+	struct target *targets;
+	size_t target_count, target_alloc;
+};
+
+struct window {
+	const unsigned char *ptr; // What to hash: slot data, or the mapped image
+	size_t len;
+	size_t target;
+};
+
+struct slot {
+	unsigned char *base;
+	unsigned char *data;
+	struct window *windows; // The batch's pieces, in hash order
+	size_t count;
+};
+
+// Single producer (the reader) and single consumer (the digest)
+struct ring {
+	struct slot slots[RING_SLOTS];
+	unsigned int head, tail, count;
+	int done;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, drained;
+	double reader_wait, digest_wait;
+};
+
+// What a cached fingerprint is valid for.  Zeroed before filling, since
+// it is hashed and compared as bytes.
+struct cache_key {
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+	char udf_vol_id[32];
+	unsigned char udf_vol_set_id[128];
+	char iso_vol_id[32];
+	unsigned char iso_vol_set_id[128];
+	char hash_names[64];
+	uint32_t merkle;
+	uint32_t all;
+};
+
+struct cache_header {
+	char magic[8];
+	uint32_t slots;
+	uint32_t pad;
+	uint64_t end; // Bytes of the file in use
+};
+
+struct cache_slot {
+	uint64_t hash; // 0 when empty
+	uint64_t offset;
+};
+
+// Followed by the fingerprint JSON, len bytes
+struct cache_record {
+	struct cache_key key;
+	uint32_t len;
+	uint32_t pad;
+};
+
+struct cache {
+	int fd;
+	unsigned char *map;
+	size_t map_len;
+	pthread_mutex_t lock; // Threads; the file lock is per process
+};
+
+enum hash_type {
+	HASH_EVP,
+	HASH_XXH3,
+	HASH_BLAKE3
+};
+
+// A digest algorithm: any that OpenSSL has, or one of the fast built-in ones
+struct algorithm {
+	char name[32];
+	enum hash_type type;
+	const EVP_MD *md;
+	unsigned int size;
+};
+
+// Running digests of several algorithms over the same bytes
+struct hashes {
+	const struct algorithm *algorithms;
+	int count;
+	union {
+		EVP_MD_CTX *context;
+		struct xxh3_state xxh3;
+		struct blake3_state blake3;
+	} state[MAX_HASHES];
+};
+
+// How images are fingerprinted, shared by every image of a batch
+struct settings {
+	struct algorithm algorithms[MAX_HASHES];
+	int hash_count;
+	int stats;
+	int merkle; // Digest per file, hash_value is H(volume ids || their Merkle root)
+	int threads; // Digest threads per image, with merkle
+	int all; // Every regular file, not only .IFO or .XML
+	int flags; // DVD_OPEN_* flags for the images
+	struct cache *cache;
+};
+
+struct walk {
+	dvd_reader_t *device;
+	char *ext; // NULL for every file
+	struct ring *ring;
+	struct plan plan;
+};
+
+double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void ring_init(struct ring *ring) {
+	unsigned int i;
+
+	memset(ring, 0, sizeof(*ring));
+	for (i = 0; i < RING_SLOTS; i++) {
+		ring->slots[i].base = malloc(BATCH_BLOCKS * DVD_VIDEO_LB_LEN + READ_ALIGN);
+		assert(ring->slots[i].base != NULL);
+		ring->slots[i].data = (unsigned char *)(((uintptr_t)ring->slots[i].base & ~((uintptr_t)READ_ALIGN - 1)) + READ_ALIGN);
+		// A piece is at least a block long
+		ring->slots[i].windows = malloc(BATCH_BLOCKS * sizeof(struct window));
+		assert(ring->slots[i].windows != NULL);
+	}
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->filled, NULL);
+	pthread_cond_init(&ring->drained, NULL);
+}
+
+void ring_free(struct ring *ring) {
+	unsigned int i;
+
+	for (i = 0; i < RING_SLOTS; i++) {
+		free(ring->slots[i].base);
+		free(ring->slots[i].windows);
+	}
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->filled);
+	pthread_cond_destroy(&ring->drained);
+}
+
+// Producer side: wait for a free slot to read into
+struct slot *ring_get_empty(struct ring *ring) {
+	struct slot *slot;
+	double start;
+
+	pthread_mutex_lock(&ring->lock);
+	if (ring->count == RING_SLOTS) {
+		start = now();
+		while (ring->count == RING_SLOTS)
+			pthread_cond_wait(&ring->drained, &ring->lock);
+		ring->reader_wait += now() - start;
+	}
+	slot = &ring->slots[ring->head];
+	pthread_mutex_unlock(&ring->lock);
+
+	return slot;
+}
+
+void ring_put_full(struct ring *ring) {
+	pthread_mutex_lock(&ring->lock);
+	ring->head = (ring->head + 1) % RING_SLOTS;
+	ring->count++;
+	pthread_cond_signal(&ring->filled);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+void ring_finish(struct ring *ring) {
+	pthread_mutex_lock(&ring->lock);
+	ring->done = 1;
+	pthread_cond_signal(&ring->filled);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+// Consumer side: next filled slot in order, NULL once the walk is over
+struct slot *ring_get_full(struct ring *ring) {
+	struct slot *slot = NULL;
+	double start;
+
+	pthread_mutex_lock(&ring->lock);
+	if (ring->count == 0 && !ring->done) {
+		start = now();
+		while (ring->count == 0 && !ring->done)
+			pthread_cond_wait(&ring->filled, &ring->lock);
+		ring->digest_wait += now() - start;
+	}
+	if (ring->count > 0)
+		slot = &ring->slots[ring->tail];
+	pthread_mutex_unlock(&ring->lock);
+
+	return slot;
+}
+
+void ring_put_empty(struct ring *ring) {
+	pthread_mutex_lock(&ring->lock);
+	ring->tail = (ring->tail + 1) % RING_SLOTS;
+	ring->count--;
+	pthread_cond_signal(&ring->drained);
+	pthread_mutex_unlock(&ring->lock);
+}
 
 // http://stackoverflow.com/a/744881
 int filename_endswith(const char *filename, const char *extension) {
@@ -39,39 +314,214 @@ char *tohex(unsigned char *bin, size_t binsz) {
 	return result;
 }
 
-void process_file(dvd_reader_t *device, char *filename, EVP_MD_CTX *messagedigest_context, char *ext) {
-	if (filename_endswith(filename, ext)) {
-		dvd_file_t *file = DVDOpenFilename(device, filename);
-		ssize_t count;
-		unsigned char buffer[DVDFileSize64(file)];
+// Lower-cased copy of name with suffix, for JSON keys
+char *lowercase(char *buffer, const char *name, const char *suffix) {
+	size_t i;
 
-		count = DVDReadBytes(file, buffer, sizeof(buffer));
-		assert(count == sizeof(buffer));
-		EVP_DigestUpdate(messagedigest_context, buffer, sizeof(buffer));
+	for (i = 0; name[i] != '\0'; i++)
+		buffer[i] = tolower((unsigned char)name[i]);
+	strcpy(buffer + i, suffix);
+	return buffer;
+}
 
-		DVDCloseFile(file);
+// Look name up among the built-in algorithms, then OpenSSL's; -1 if unknown.
+// Names are matched in any case and kept upper case, as OpenSSL gives them.
+int algorithm_init(struct algorithm *algorithm, const char *name) {
+	EVP_MD_CTX *context;
+	int ret;
+
+	memset(algorithm, 0, sizeof(*algorithm));
+	if (strcasecmp(name, "xxh3") == 0) {
+		strcpy(algorithm->name, "XXH3");
+		algorithm->type = HASH_XXH3;
+		algorithm->size = sizeof(uint64_t);
+		return 0;
+	}
+	if (strcasecmp(name, "blake3") == 0) {
+		strcpy(algorithm->name, "BLAKE3");
+		algorithm->type = HASH_BLAKE3;
+		algorithm->size = BLAKE3_OUT_LEN;
+		return 0;
+	}
+	algorithm->md = EVP_get_digestbyname(name);
+	if (algorithm->md == NULL)
+		return -1;
+	// OpenSSL knows the names of digests its providers may not load
+	context = EVP_MD_CTX_create();
+	assert(context != NULL);
+	ret = EVP_DigestInit_ex(context, algorithm->md, NULL);
+	EVP_MD_CTX_destroy(context);
+	if (ret != 1)
+		return -1;
+	snprintf(algorithm->name, sizeof(algorithm->name), "%s", EVP_MD_name(algorithm->md));
+	algorithm->type = HASH_EVP;
+	algorithm->size = EVP_MD_size(algorithm->md);
+	return 0;
+}
+
+void hashes_init(struct hashes *hashes) {
+	int i;
+
+	for (i = 0; i < hashes->count; i++) {
+		switch (hashes->algorithms[i].type) {
+			case HASH_EVP:
+				EVP_DigestInit_ex(hashes->state[i].context, hashes->algorithms[i].md, NULL);
+				break;
+			case HASH_XXH3:
+				xxh3_init(&hashes->state[i].xxh3);
+				break;
+			case HASH_BLAKE3:
+				blake3_init(&hashes->state[i].blake3);
+				break;
+		}
+	}
+}
+
+void hashes_create(struct hashes *hashes, const struct algorithm *algorithms, int count) {
+	int i;
+
+	hashes->algorithms = algorithms;
+	hashes->count = count;
+	for (i = 0; i < count; i++) {
+		if (algorithms[i].type == HASH_EVP) {
+			hashes->state[i].context = EVP_MD_CTX_create();
+			assert(hashes->state[i].context != NULL);
+		}
+	}
+	hashes_init(hashes);
+}
+
+void hashes_destroy(struct hashes *hashes) {
+	int i;
+
+	for (i = 0; i < hashes->count; i++)
+		if (hashes->algorithms[i].type == HASH_EVP)
+			EVP_MD_CTX_destroy(hashes->state[i].context);
+}
+
+// Feed only the i-th algorithm
+void hash_update(struct hashes *hashes, int i, const void *data, size_t len) {
+	switch (hashes->algorithms[i].type) {
+		case HASH_EVP:
+			EVP_DigestUpdate(hashes->state[i].context, data, len);
+			break;
+		case HASH_XXH3:
+			xxh3_update(&hashes->state[i].xxh3, data, len);
+			break;
+		case HASH_BLAKE3:
+			blake3_update(&hashes->state[i].blake3, data, len);
+			break;
+	}
+}
+
+void hashes_update(struct hashes *hashes, const void *data, size_t len) {
+	int i;
+
+	for (i = 0; i < hashes->count; i++)
+		hash_update(hashes, i, data, len);
+}
+
+// Store each algorithm's digest, xxh3 big-endian as it is printed, and
+// start over
+void hashes_final(struct hashes *hashes, unsigned char (*digests)[EVP_MAX_MD_SIZE]) {
+	uint64_t value;
+	int i, j;
+
+	for (i = 0; i < hashes->count; i++) {
+		switch (hashes->algorithms[i].type) {
+			case HASH_EVP:
+				EVP_DigestFinal_ex(hashes->state[i].context, digests[i], NULL);
+				break;
+			case HASH_XXH3:
+				value = xxh3_digest(&hashes->state[i].xxh3);
+				for (j = 0; j < 8; j++)
+					digests[i][j] = value >> (56 - 8 * j);
+				break;
+			case HASH_BLAKE3:
+				blake3_digest(&hashes->state[i].blake3, digests[i]);
+				break;
+		}
+	}
+	hashes_init(hashes);
+}
+
+// Split a target file into pieces that each lie in one run of its extents
+void plan_file(struct walk *walk, char *filename, dvd_dirent_t *dirent) {
+	struct plan *plan = &walk->plan;
+	dvd_file_t *file = DVDOpenFilename(walk->device, filename);
+	uint64_t remaining = DVDFileSize64(file);
+	struct target *target;
+	struct piece *piece;
+	uint32_t lb, run;
+	int offset = 0;
+
+	if (plan->target_count == plan->target_alloc) {
+		plan->target_alloc = plan->target_alloc ? plan->target_alloc * 2 : 16;
+		plan->targets = realloc(plan->targets, plan->target_alloc * sizeof(*plan->targets));
+		assert(plan->targets != NULL);
+	}
+	target = &plan->targets[plan->target_count++];
+	target->file = file;
+	target->path = strdup(filename);
+	assert(target->path != NULL);
+	target->size = remaining;
+	target->first_piece = plan->count;
+
+	while (remaining > 0) {
+		size_t bytes = (remaining < READ_BLOCKS * DVD_VIDEO_LB_LEN) ? remaining : READ_BLOCKS * DVD_VIDEO_LB_LEN;
+		size_t blocks = (bytes + DVD_VIDEO_LB_LEN - 1) / DVD_VIDEO_LB_LEN;
+
+		// No run past the recorded extents: the file is taken as contiguous
+		lb = UDFFileBlockFileRun(walk->device, &dirent->dir_file, offset, &run);
+		if (run != 0 && run < blocks) {
+			blocks = run;
+			bytes = blocks * DVD_VIDEO_LB_LEN;
+		}
+
+		if (plan->count == plan->alloc) {
+			plan->alloc = plan->alloc ? plan->alloc * 2 : 256;
+			plan->pieces = realloc(plan->pieces, plan->alloc * sizeof(*plan->pieces));
+			assert(plan->pieces != NULL);
+		}
+		piece = &plan->pieces[plan->count++];
+		piece->file = file;
+		piece->target = plan->target_count - 1;
+		piece->offset = offset;
+		piece->lb = lb;
+		piece->blocks = blocks;
+		piece->len = bytes;
+
+		offset += blocks;
+		remaining -= bytes;
 	}
+	target->pieces = plan->count - target->first_piece;
 }
 
-void process_directory(dvd_reader_t *device, char *dirname, EVP_MD_CTX *messagedigest_context, char *ext) {
+// Collect the pieces of the target files, in traversal order
+void plan_directory(struct walk *walk, char *dirname) {
 	char path[MAX_UDF_FILE_NAME_LEN + 1];
 	dvd_dir_t *dir;
 	dvd_dirent_t *dirent;
 
 	path[sizeof(path) - 1] = 0;
 
-	dir = DVDOpenDir(device, dirname);
+	// Only names and types are needed here, the extents only for targets
+	dir = DVDOpenDirFlags(walk->device, dirname, DVD_DIR_NAMES_ONLY);
 	assert(dir != NULL);
 
-	while ((dirent = DVDReadDir(device, dir)) != NULL) {
+	while ((dirent = DVDReadDir(walk->device, dir)) != NULL) {
 		snprintf(path, sizeof(path) - 1, "%s/%s", dirname, dirent->d_name);
 
 		switch (dirent->d_type) {
 			case DVD_DT_DIR:
-				process_directory(device, path, messagedigest_context, ext);
+				plan_directory(walk, path);
 				break;
 			case DVD_DT_REG:
-				process_file(device, path, messagedigest_context, ext);
+				if (walk->ext == NULL || filename_endswith(path, walk->ext)) {
+					dirent = DVDStatDirent(walk->device, dir);
+					assert(dirent != NULL);
+					plan_file(walk, path, dirent);
+				}
 				break;
 			default:
 				fprintf(stderr, "Unhandled type %d\n", dirent->d_type);
@@ -79,37 +529,555 @@ void process_directory(dvd_reader_t *device, char *dirname, EVP_MD_CTX *messaged
 		}
 	}
 
-	DVDCloseDir(device, dir);
+	DVDCloseDir(walk->device, dir);
 }
 
-int main(int argc, char *argv[]) {
+int piece_cmp(const void *a, const void *b) {
+	const struct piece *x = *(struct piece * const *)a, *y = *(struct piece * const *)b;
+
+	return (x->lb > y->lb) - (x->lb < y->lb);
+}
+
+// Close the targets once their data has been read; their paths and digests
+// are still wanted for the output
+void plan_release(struct plan *plan) {
+	size_t i;
+
+	for (i = 0; i < plan->target_count; i++)
+		DVDCloseFile(plan->targets[i].file);
+	free(plan->pieces);
+	plan->pieces = NULL;
+}
+
+// Wait for a queued read of the reader thread, it must be whole
+void reap_piece(dvd_read_queue_t *queue) {
+	void *tag;
+	ssize_t count = DVDReapReadBlocks(queue, &tag, 1);
+
+	assert(tag != NULL);
+	assert(count == (ssize_t)((struct piece *)tag)->blocks);
+}
+
+// Reader thread: fill ring slots with the plan, batch by batch.  Each
+// batch is read in ascending block order and hashed in plan order; when
+// the image isn't mapped, its reads are all queued at once.
+void *read_tree(void *arg) {
+	struct walk *walk = arg;
+	struct plan *plan = &walk->plan;
+	struct piece **order;
+	struct piece *piece;
+	struct slot *slot;
+	dvd_read_queue_t *queue;
+	size_t first, last, blocks, span, count, i;
+	unsigned int queued;
+
+	order = malloc(BATCH_BLOCKS * sizeof(*order));
+	assert(order != NULL);
+	queue = DVDOpenReadQueue(walk->device, QUEUE_DEPTH);
+	assert(queue != NULL);
+
+	for (first = 0; first < plan->count; first = last) {
+		slot = ring_get_empty(walk->ring);
+
+		// Each piece starts aligned in the slot, for O_DIRECT
+		blocks = 0;
+		for (last = first; last < plan->count; last++) {
+			piece = &plan->pieces[last];
+			span = (piece->blocks + ALIGN_BLOCKS - 1) & ~(size_t)(ALIGN_BLOCKS - 1);
+			if (blocks + span > BATCH_BLOCKS)
+				break;
+			piece->buffer = slot->data + blocks * DVD_VIDEO_LB_LEN;
+			order[last - first] = piece;
+			blocks += span;
+		}
+		slot->count = last - first;
+		qsort(order, slot->count, sizeof(*order), piece_cmp);
+
+		queued = 0;
+		for (i = 0; i < slot->count; i++) {
+			struct window *window;
+
+			piece = order[i];
+			window = &slot->windows[piece - &plan->pieces[first]];
+			window->len = piece->len;
+			window->target = piece->target;
+
+			// Hash in place when the image is mapped
+			count = piece->blocks;
+			window->ptr = DVDMapBlocks(piece->file, piece->offset, &count);
+			if (window->ptr == NULL || count < piece->blocks) {
+				window->ptr = piece->buffer;
+				while (DVDQueueReadBlocks(queue, piece->file, piece->offset, piece->blocks, piece->buffer, piece) < 0) {
+					// Queue full, make room first
+					assert(queued > 0);
+					reap_piece(queue);
+					queued--;
+				}
+				queued++;
+			}
+		}
+		for (; queued > 0; queued--)
+			reap_piece(queue);
+		ring_put_full(walk->ring);
+	}
+
+	ring_finish(walk->ring);
+
+	DVDCloseReadQueue(queue);
+	free(order);
+	plan_release(plan);
+
+	return NULL;
+}
+
+// Digest pool for --files: workers take whole files and hash each with its
+// own context, so the files of one image are spread over several cores.
+// Each worker reads through its own reader: one is not safe to share
+// between threads, as with libdvdcss its title key follows the file read.
+struct pool_job {
+	uint32_t lb;
+	size_t target;
+};
+
+struct pool {
+	const char *image;
+	struct plan *plan;
+	const struct settings *settings;
+	struct pool_job *jobs; // By first block, so reads move through the disc
+	size_t next;
+	double busy;           // Summed over the workers, for --stats
+	pthread_mutex_t lock;
+};
+
+int pool_job_cmp(const void *a, const void *b) {
+	const struct pool_job *x = a, *y = b;
+
+	return (x->lb > y->lb) - (x->lb < y->lb);
+}
+
+void *pool_worker(void *arg) {
+	struct pool *pool = arg;
+	struct plan *plan = pool->plan;
+	const unsigned char *ptr;
+	unsigned char *base, *data;
+	struct target *target;
+	struct piece *piece;
+	struct hashes hashes;
+	dvd_reader_t *device;
+	dvd_file_t *file;
+	size_t i, count;
+	double start, busy = 0;
+
+	device = DVDOpenFlags(pool->image, pool->settings->flags);
+	assert(device != NULL);
+	base = malloc(READ_BLOCKS * DVD_VIDEO_LB_LEN + READ_ALIGN);
+	assert(base != NULL);
+	data = (unsigned char *)(((uintptr_t)base & ~((uintptr_t)READ_ALIGN - 1)) + READ_ALIGN);
+	hashes_create(&hashes, pool->settings->algorithms, pool->settings->hash_count);
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		if (pool->next == plan->target_count) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		target = &plan->targets[pool->jobs[pool->next++].target];
+		pthread_mutex_unlock(&pool->lock);
+
+		start = now();
+		file = DVDOpenFilename(device, target->path);
+		assert(file != NULL);
+		for (i = 0; i < target->pieces; i++) {
+			piece = &plan->pieces[target->first_piece + i];
+
+			// Hash in place when the image is mapped
+			count = piece->blocks;
+			ptr = DVDMapBlocks(file, piece->offset, &count);
+			if (ptr == NULL || count < piece->blocks) {
+				count = DVDReadBlocks(file, piece->offset, piece->blocks, data);
+				assert(count == piece->blocks);
+				ptr = data;
+			}
+			hashes_update(&hashes, ptr, piece->len);
+		}
+		DVDCloseFile(file);
+		hashes_final(&hashes, target->digests);
+		busy += now() - start;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->busy += busy;
+	pthread_mutex_unlock(&pool->lock);
+
+	hashes_destroy(&hashes);
+	free(base);
+	DVDClose(device);
+
+	return NULL;
+}
+
+// Fill in every target's digest with up to threads workers, reading image.
+// Returns the time spent reading and hashing, summed over the workers.
+double hash_targets(const char *image, struct plan *plan, const struct settings *settings) {
+	int threads = settings->threads;
+	struct pool pool;
+	pthread_t *workers;
+	size_t i;
+	int ret;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.image = image;
+	pool.plan = plan;
+	pool.settings = settings;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	pool.jobs = malloc((plan->target_count + 1) * sizeof(*pool.jobs));
+	assert(pool.jobs != NULL);
+	for (i = 0; i < plan->target_count; i++) {
+		pool.jobs[i].target = i;
+		pool.jobs[i].lb = plan->targets[i].pieces ? plan->pieces[plan->targets[i].first_piece].lb : 0;
+	}
+	qsort(pool.jobs, plan->target_count, sizeof(*pool.jobs), pool_job_cmp);
+
+	if ((size_t)threads > plan->target_count)
+		threads = plan->target_count ? plan->target_count : 1;
+	workers = malloc(threads * sizeof(*workers));
+	assert(workers != NULL);
+
+	for (i = 0; i < (size_t)threads; i++) {
+		ret = pthread_create(&workers[i], NULL, pool_worker, &pool);
+		assert(ret == 0);
+	}
+	for (i = 0; i < (size_t)threads; i++)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	free(pool.jobs);
+	pthread_mutex_destroy(&pool.lock);
+
+	return pool.busy;
+}
+
+#define CACHE_TABLE_END (sizeof(struct cache_header) + CACHE_SLOTS * sizeof(struct cache_slot))
+
+// Lock the cache against other threads and processes
+void cache_lock(struct cache *cache) {
+	struct flock fl;
+
+	pthread_mutex_lock(&cache->lock);
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(cache->fd, F_SETLKW, &fl) < 0)
+		assert(errno == EINTR);
+}
+
+void cache_unlock(struct cache *cache) {
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fcntl(cache->fd, F_SETLK, &fl);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Map the file as it is now, other processes may have grown it
+int cache_remap(struct cache *cache) {
+	struct stat st;
+	void *map;
+
+	if (fstat(cache->fd, &st) < 0)
+		return -1;
+	if ((size_t)st.st_size == cache->map_len)
+		return 0;
+	if (cache->map != NULL)
+		munmap(cache->map, cache->map_len);
+	cache->map = NULL;
+	cache->map_len = 0;
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	cache->map = map;
+	cache->map_len = st.st_size;
+	return 0;
+}
+
+// Empty the table; the file keeps its size, so mappings elsewhere stay valid
+void cache_reset(struct cache *cache) {
+	struct cache_header *header = (struct cache_header *)cache->map;
+
+	memset(cache->map, 0, CACHE_TABLE_END);
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->slots = CACHE_SLOTS;
+	header->end = CACHE_TABLE_END;
+}
+
+// Open or create the cache file; NULL if it can't be used
+struct cache *cache_open(const char *path) {
+	struct cache *cache;
+	struct cache_header *header;
+	int ok;
+
+	cache = calloc(1, sizeof(*cache));
+	assert(cache != NULL);
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (cache->fd < 0) {
+		perror(path);
+		free(cache);
+		return NULL;
+	}
+
+	cache_lock(cache);
+	ok = cache_remap(cache) == 0;
+	if (ok && cache->map_len < CACHE_TABLE_END) {
+		ok = ftruncate(cache->fd, CACHE_TABLE_END) == 0 && cache_remap(cache) == 0;
+		if (ok)
+			cache_reset(cache);
+	}
+	if (ok) {
+		header = (struct cache_header *)cache->map;
+		if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+		    header->slots != CACHE_SLOTS || header->end < CACHE_TABLE_END ||
+		    header->end > cache->map_len)
+			cache_reset(cache);
+	}
+	cache_unlock(cache);
+
+	if (!ok) {
+		fprintf(stderr, "%s: can't map the cache\n", path);
+		if (cache->map != NULL)
+			munmap(cache->map, cache->map_len);
+		close(cache->fd);
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void cache_close(struct cache *cache) {
+	munmap(cache->map, cache->map_len);
+	close(cache->fd);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+// FNV-1a, never 0 so that 0 can mark empty slots
+uint64_t cache_hash(const struct cache_key *key) {
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	return hash ? hash : 1;
+}
+
+// Key for an image, from its inode and the volume ids read so far.
+// Returns -1 for anything but a regular file, whose contents can change
+// under the same name without the inode showing it.
+int cache_key_init(struct cache_key *key, const char *image, const struct settings *settings) {
+	struct stat st;
+	size_t len;
+	int i;
+
+	memset(key, 0, sizeof(*key));
+	if (stat(image, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	key->dev = st.st_dev;
+	key->ino = st.st_ino;
+	key->size = st.st_size;
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	for (i = 0; i < settings->hash_count; i++) {
+		len = strlen(key->hash_names);
+		snprintf(key->hash_names + len, sizeof(key->hash_names) - len, "%s%s", i ? "," : "", settings->algorithms[i].name);
+	}
+	key->merkle = settings->merkle;
+	key->all = settings->all;
+	return 0;
+}
+
+// The record of key's slot, or of the slot to overwrite when none has key
+struct cache_slot *cache_find(struct cache *cache, const struct cache_key *key, uint64_t hash, int *found) {
+	struct cache_slot *slots = (struct cache_slot *)(cache->map + sizeof(struct cache_header));
+	struct cache_slot *slot;
+	struct cache_record *record;
+	unsigned int i;
+
+	*found = 0;
+	for (i = 0; i < CACHE_PROBES; i++) {
+		slot = &slots[(hash + i) & (CACHE_SLOTS - 1)];
+		if (slot->hash == 0)
+			return slot;
+		if (slot->hash != hash || slot->offset < CACHE_TABLE_END ||
+		    slot->offset + sizeof(*record) > cache->map_len)
+			continue;
+		record = (struct cache_record *)(cache->map + slot->offset);
+		if (slot->offset + sizeof(*record) + record->len > cache->map_len ||
+		    memcmp(&record->key, key, sizeof(*key)) != 0)
+			continue;
+		*found = 1;
+		return slot;
+	}
+	return &slots[hash & (CACHE_SLOTS - 1)];
+}
+
+// The cached fingerprint for key, or NULL
+json_t *cache_get(struct cache *cache, const struct cache_key *key) {
+	struct cache_slot *slot;
+	struct cache_record *record;
+	json_t *obj = NULL;
+	int found;
+
+	cache_lock(cache);
+	if (cache_remap(cache) == 0) {
+		slot = cache_find(cache, key, cache_hash(key), &found);
+		if (found) {
+			record = (struct cache_record *)(cache->map + slot->offset);
+			obj = json_loadb((const char *)(record + 1), record->len, 0, NULL);
+		}
+	}
+	cache_unlock(cache);
+
+	return obj;
+}
+
+void cache_put(struct cache *cache, const struct cache_key *key, json_t *obj) {
+	struct cache_header *header;
+	struct cache_slot *slot;
+	struct cache_record *record;
+	uint64_t hash = cache_hash(key);
+	size_t len, need, size;
+	char *str;
+	int found;
+
+	str = json_dumps(obj, 0);
+	assert(str != NULL);
+	len = strlen(str);
+	need = (sizeof(*record) + len + 7) & ~(size_t)7;
+
+	cache_lock(cache);
+	if (cache_remap(cache) < 0)
+		goto out;
+	header = (struct cache_header *)cache->map;
+	if (header->end + need > CACHE_MAX_BYTES)
+		cache_reset(cache);
+	if (header->end + need > cache->map_len) {
+		size = cache->map_len * 2;
+		if (size < header->end + need)
+			size = header->end + need;
+		if (ftruncate(cache->fd, size) < 0 || cache_remap(cache) < 0)
+			goto out;
+		header = (struct cache_header *)cache->map;
+	}
+
+	record = (struct cache_record *)(cache->map + header->end);
+	record->key = *key;
+	record->len = len;
+	memcpy(record + 1, str, len);
+
+	slot = cache_find(cache, key, hash, &found);
+	slot->hash = hash;
+	slot->offset = header->end;
+	header->end += need;
+out:
+	cache_unlock(cache);
+	free(str);
+}
+
+// Merkle root of the targets' digests of one algorithm, in order.  As in
+// RFC 6962, leaves are hashed as 0x00 || digest and pairs as 0x01 || left ||
+// right, so a file digest can't stand in for an inner node.  An odd node
+// out is carried up a level as it is, and no targets give the digest of
+// nothing.
+unsigned int merkle_root(const struct algorithm *algorithm, const struct target *targets, size_t count,
+                         int index, unsigned char *root) {
+	unsigned int len = algorithm->size;
+	unsigned char digest[1][EVP_MAX_MD_SIZE];
+	const unsigned char leaf = 0x00, node = 0x01;
+	unsigned char *level;
+	struct hashes hashes;
+	size_t i;
+
+	hashes_create(&hashes, algorithm, 1);
+	if (count == 0) {
+		hashes_final(&hashes, digest);
+		memcpy(root, digest[0], len);
+		hashes_destroy(&hashes);
+		return len;
+	}
+
+	level = malloc(count * len);
+	assert(level != NULL);
+	for (i = 0; i < count; i++) {
+		hashes_update(&hashes, &leaf, 1);
+		hashes_update(&hashes, targets[i].digests[index], len);
+		hashes_final(&hashes, digest);
+		memcpy(level + i * len, digest[0], len);
+	}
+
+	while (count > 1) {
+		for (i = 0; i + 1 < count; i += 2) {
+			hashes_update(&hashes, &node, 1);
+			hashes_update(&hashes, level + i * len, 2 * len);
+			hashes_final(&hashes, digest);
+			memcpy(level + (i / 2) * len, digest[0], len);
+		}
+		if (count % 2)
+			memmove(level + (count / 2) * len, level + (count - 1) * len, len);
+		count = (count + 1) / 2;
+	}
+
+	memcpy(root, level, len);
+	free(level);
+	hashes_destroy(&hashes);
+	return len;
+}
+
+// Fingerprint one image; NULL if it can't be opened
+json_t *fingerprint(const char *image, const struct settings *settings) {
+	const struct algorithm *algorithms = settings->algorithms;
 	char volid[32];
 	unsigned char volsetid[128];
-	unsigned char messagedigest_value[EVP_MAX_MD_SIZE];
-	unsigned int messagedigest_len;
+	unsigned char values[MAX_HASHES][EVP_MAX_MD_SIZE];
+	char name[sizeof(algorithms->name) + 8];
+	int ret, k;
+	int use_cache = 0;
+	size_t i, finished = 0;
+	uint64_t bytes = 0;
+	double start, read_start, digest_time = 0;
 	char *ext;
 	char *str;
 	dvd_reader_t *device;
 	dvd_file_t *file;
-	json_t *obj = json_object();
-	const EVP_MD *messagedigest;
-	EVP_MD_CTX messagedigest_context;
-
-	OpenSSL_add_all_digests();
-	messagedigest = EVP_get_digestbyname(HASH_NAME);
-	assert(messagedigest != NULL);
+	json_t *obj, *cached, *files, *entry;
+	struct cache_key key;
+	struct hashes hashes, file_hashes;
+	struct ring ring;
+	struct walk walk;
+	struct slot *slot;
+	struct window *window;
+	struct target *target;
+	pthread_t reader;
 
-	EVP_MD_CTX_init(&messagedigest_context);
-	EVP_DigestInit_ex(&messagedigest_context, messagedigest, NULL);
+	start = now();
+	if (settings->cache != NULL)
+		use_cache = cache_key_init(&key, image, settings) == 0;
+	device = DVDOpenFlags(image, settings->flags);
+	if (device == NULL)
+		return NULL;
 
-	assert(argc == 2);
-	device = DVDOpen(argv[1]);
-	assert(device != NULL);
+	obj = json_object();
+	hashes_create(&hashes, algorithms, settings->hash_count);
 
 	memset(volid, 0, sizeof(volid));
 	DVDUDFVolumeInfo(device, volid, sizeof(volid), volsetid, sizeof(volsetid));
-	EVP_DigestUpdate(&messagedigest_context, volid, sizeof(volid));
-	EVP_DigestUpdate(&messagedigest_context, volsetid, sizeof(volsetid));
+	hashes_update(&hashes, volid, sizeof(volid));
+	hashes_update(&hashes, volsetid, sizeof(volsetid));
+	memcpy(key.udf_vol_id, volid, sizeof(volid));
+	memcpy(key.udf_vol_set_id, volsetid, sizeof(volsetid));
 
 	json_object_set_new(obj, "udf_vol_id", json_string(volid));
 
@@ -119,8 +1087,10 @@ int main(int argc, char *argv[]) {
 
 	memset(volid, 0, sizeof(volid));
 	DVDISOVolumeInfo(device, volid, sizeof(volid), volsetid, sizeof(volsetid));
-	EVP_DigestUpdate(&messagedigest_context, volid, sizeof(volid));
-	EVP_DigestUpdate(&messagedigest_context, volsetid, sizeof(volsetid));
+	hashes_update(&hashes, volid, sizeof(volid));
+	hashes_update(&hashes, volsetid, sizeof(volsetid));
+	memcpy(key.iso_vol_id, volid, sizeof(volid));
+	memcpy(key.iso_vol_set_id, volsetid, sizeof(volsetid));
 
 	json_object_set_new(obj, "iso_vol_id", json_string(volid));
 
@@ -128,6 +1098,16 @@ int main(int argc, char *argv[]) {
 	json_object_set_new(obj, "iso_vol_set_id", json_string(str));
 	free(str);
 
+	// Same inode, same volume ids: the tree needn't be read again
+	if (use_cache && (cached = cache_get(settings->cache, &key)) != NULL) {
+		DVDClose(device);
+		hashes_destroy(&hashes);
+		json_decref(obj);
+		if (settings->stats)
+			fprintf(stderr, "%s: cache hit, elapsed %.6fs\n", image, now() - start);
+		return cached;
+	}
+
 	file = DVDOpenFilename(device, "/VIDEO_TS/VIDEO_TS.IFO");
 	if (file != NULL) {
 		DVDCloseFile(file);
@@ -138,22 +1118,348 @@ int main(int argc, char *argv[]) {
 		ext = ".XML";
 	}
 
-	process_directory(device, "", &messagedigest_context, ext);
+	walk.device = device;
+	walk.ext = settings->all ? NULL : ext;
+	walk.ring = &ring;
+	memset(&walk.plan, 0, sizeof(walk.plan));
+	plan_directory(&walk, "");
+
+	for (i = 0; i < walk.plan.target_count; i++)
+		bytes += walk.plan.targets[i].size;
+	read_start = now();
+
+	if (settings->merkle && settings->threads > 1) {
+		// Files are independent, hash them side by side
+		digest_time = hash_targets(image, &walk.plan, settings);
+		plan_release(&walk.plan);
+	} else {
+		ring_init(&ring);
+		ret = pthread_create(&reader, NULL, read_tree, &walk);
+		assert(ret == 0);
+
+		if (settings->merkle)
+			hashes_create(&file_hashes, algorithms, settings->hash_count);
+
+		while ((slot = ring_get_full(&ring)) != NULL) {
+			double hash_start = now();
+
+			for (i = 0; i < slot->count; i++) {
+				window = &slot->windows[i];
+				if (!settings->merkle) {
+					hashes_update(&hashes, window->ptr, window->len);
+					continue;
+				}
+				// Windows come file by file; empty files have none
+				while (finished < window->target)
+					hashes_final(&file_hashes, walk.plan.targets[finished++].digests);
+				hashes_update(&file_hashes, window->ptr, window->len);
+			}
+			digest_time += now() - hash_start;
+			ring_put_empty(&ring);
+		}
+
+		pthread_join(reader, NULL);
+
+		if (settings->merkle) {
+			while (finished < walk.plan.target_count)
+				hashes_final(&file_hashes, walk.plan.targets[finished++].digests);
+			hashes_destroy(&file_hashes);
+		}
+
+		if (settings->stats) {
+			fprintf(stderr, "%s: reader waited %.3fs for free slots\n", image, ring.reader_wait);
+			fprintf(stderr, "%s: digest waited %.3fs for data, hashed for %.3fs\n", image, ring.digest_wait, digest_time);
+		}
+		ring_free(&ring);
+	}
 
 	DVDClose(device);
 
-	EVP_DigestFinal_ex(&messagedigest_context, messagedigest_value, &messagedigest_len);
-	EVP_MD_CTX_cleanup(&messagedigest_context);
+	// Planning is left out, it reads only metadata
+	if (settings->all) {
+		double elapsed = now() - read_start;
 
-	str = tohex(messagedigest_value, messagedigest_len);
-	json_object_set_new(obj, "hash_value", json_string(str));
-	free(str);
+		fprintf(stderr, "%s: %.1f MiB of file data in %.3fs, %.1f MiB/s\n", image,
+		        bytes / 1048576.0, elapsed, elapsed > 0 ? bytes / 1048576.0 / elapsed : 0);
+	}
 
-	str = json_dumps(obj, 0);
-	fputs(str, stdout);
-	free(str);
+	if (settings->merkle) {
+		unsigned char root[EVP_MAX_MD_SIZE];
+		unsigned int root_len;
+
+		// Each value covers the volume ids, then its root over the files
+		for (k = 0; k < settings->hash_count; k++) {
+			root_len = merkle_root(&algorithms[k], walk.plan.targets, walk.plan.target_count, k, root);
+			hash_update(&hashes, k, root, root_len);
+		}
+
+		files = json_array();
+		for (i = 0; i < walk.plan.target_count; i++) {
+			target = &walk.plan.targets[i];
+			entry = json_object();
+			json_object_set_new(entry, "path", json_string(target->path));
+			json_object_set_new(entry, "size", json_integer(target->size));
+			for (k = 0; k < settings->hash_count; k++) {
+				str = tohex(target->digests[k], algorithms[k].size);
+				json_object_set_new(entry, k ? lowercase(name, algorithms[k].name, "") : "digest", json_string(str));
+				free(str);
+			}
+			json_array_append_new(files, entry);
+		}
+		json_object_set_new(obj, "hash_tree", json_string("merkle"));
+		json_object_set_new(obj, "files", files);
+	}
+
+	for (i = 0; i < walk.plan.target_count; i++)
+		free(walk.plan.targets[i].path);
+	free(walk.plan.targets);
+
+	hashes_final(&hashes, values);
+	hashes_destroy(&hashes);
+
+	// The first algorithm gives hash_value, any others their own <name>_value
+	json_object_set_new(obj, "hash_name", json_string(algorithms[0].name));
+	for (k = 0; k < settings->hash_count; k++) {
+		str = tohex(values[k], algorithms[k].size);
+		json_object_set_new(obj, k ? lowercase(name, algorithms[k].name, "_value") : "hash_value", json_string(str));
+		free(str);
+	}
+	if (settings->all)
+		json_object_set_new(obj, "content", json_string("all"));
+
+	if (settings->stats) {
+		if (settings->merkle && settings->threads > 1)
+			fprintf(stderr, "%s: %d digest threads read and hashed for %.3fs in all\n", image, settings->threads, digest_time);
+		fprintf(stderr, "%s: elapsed %.3fs\n", image, now() - start);
+	}
+
+	if (use_cache)
+		cache_put(settings->cache, &key, obj);
+
+	return obj;
+}
+
+// Batch mode: images come from argv, or one per line on stdin
+struct batch {
+	char **images;
+	int count, next;
+	FILE *list;
+	const struct settings *settings;
+	pthread_mutex_t lock;
+};
+
+// Next image path for a worker, NULL when the list is exhausted
+char *batch_next(struct batch *batch) {
+	char line[4096];
+	char *image = NULL;
+	size_t len;
+
+	pthread_mutex_lock(&batch->lock);
+	if (batch->list == NULL) {
+		if (batch->next < batch->count)
+			image = strdup(batch->images[batch->next++]);
+	} else {
+		while (image == NULL && fgets(line, sizeof(line), batch->list) != NULL) {
+			len = strlen(line);
+			while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+				line[--len] = 0;
+			if (len > 0)
+				image = strdup(line);
+		}
+	}
+	pthread_mutex_unlock(&batch->lock);
+
+	return image;
+}
+
+void *batch_worker(void *arg) {
+	struct batch *batch = arg;
+	char *image;
+	char *str;
+	json_t *obj;
+
+	while ((image = batch_next(batch)) != NULL) {
+		obj = fingerprint(image, batch->settings);
+		if (obj == NULL) {
+			obj = json_object();
+			json_object_set_new(obj, "error", json_string("could not open image"));
+		}
+		json_object_set_new(obj, "path", json_string(image));
+
+		str = json_dumps(obj, 0);
+		pthread_mutex_lock(&batch->lock);
+		fputs(str, stdout);
+		fputc('\n', stdout);
+		fflush(stdout);
+		pthread_mutex_unlock(&batch->lock);
+		free(str);
+
+		json_decref(obj);
+		free(image);
+	}
+
+	return NULL;
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--stats] [--all] [--direct] [--hash LIST] [--files [--threads N]] [--cache FILE] <image>\n", name);
+	fprintf(stderr, "       %s --batch [--jobs N] [--stats] [--all] [--direct] [--hash LIST] [--files [--threads N]] [--cache FILE] [image...]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int batch_mode = 0, jobs = 0;
+	int opt, ret, i;
+	char *str;
+	json_t *obj;
+	struct settings settings;
+	struct batch batch;
+	char *cache_path = NULL;
+	char *hash_list = NULL;
+	char *name, *saveptr;
+	pthread_t *workers;
+	static const struct option options[] = {
+		{ "stats", no_argument, NULL, 's' },
+		{ "batch", no_argument, NULL, 'b' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "cache", required_argument, NULL, 'c' },
+		{ "files", no_argument, NULL, 'f' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "all", no_argument, NULL, 'a' },
+		{ "direct", no_argument, NULL, 'd' },
+		{ "hash", required_argument, NULL, 'H' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	memset(&settings, 0, sizeof(settings));
+	// Hash image files in place, unless --direct
+	settings.flags = DVD_OPEN_MAP;
+
+	while ((opt = getopt_long(argc, argv, "sbj:c:ft:adH:", options, NULL)) != -1) {
+		switch (opt) {
+			case 's':
+				settings.stats = 1;
+				break;
+			case 'b':
+				batch_mode = 1;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1)
+					usage(argv[0]);
+				break;
+			case 'c':
+				cache_path = optarg;
+				break;
+			case 'f':
+				settings.merkle = 1;
+				break;
+			case 't':
+				settings.threads = atoi(optarg);
+				if (settings.threads < 1)
+					usage(argv[0]);
+				break;
+			case 'a':
+				settings.all = 1;
+				break;
+			case 'd':
+				// Stream past the page cache
+				settings.flags = DVD_OPEN_DIRECT;
+				break;
+			case 'H':
+				hash_list = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (!batch_mode && optind != argc - 1)
+		usage(argv[0]);
+
+	OpenSSL_add_all_digests();
+	if (hash_list == NULL)
+		hash_list = settings.all ? DEFAULT_ALL_HASHES : DEFAULT_HASHES;
+	hash_list = strdup(hash_list);
+	assert(hash_list != NULL);
+	for (name = strtok_r(hash_list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+		if (settings.hash_count == MAX_HASHES) {
+			fprintf(stderr, "At most %d digests can be taken at once\n", MAX_HASHES);
+			exit(1);
+		}
+		if (algorithm_init(&settings.algorithms[settings.hash_count], name) != 0) {
+			fprintf(stderr, "Unknown digest: %s\n", name);
+			exit(1);
+		}
+		for (i = 0; i < settings.hash_count; i++) {
+			if (strcmp(settings.algorithms[i].name, settings.algorithms[settings.hash_count].name) == 0) {
+				fprintf(stderr, "Digest given twice: %s\n", name);
+				exit(1);
+			}
+		}
+		settings.hash_count++;
+	}
+	free(hash_list);
+	if (settings.hash_count == 0)
+		usage(argv[0]);
+
+	// Pick the SIMD code paths before any thread hashes
+	xxh3_select();
+	blake3_select();
+
+	// One image gets every core; a batch already has one image per core
+	if (settings.threads == 0)
+		settings.threads = batch_mode ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+	if (settings.threads < 1)
+		settings.threads = 1;
+
+	// Without a usable cache, images are simply fingerprinted every time
+	if (cache_path != NULL)
+		settings.cache = cache_open(cache_path);
+
+	if (!batch_mode) {
+		obj = fingerprint(argv[optind], &settings);
+		assert(obj != NULL);
+
+		str = json_dumps(obj, 0);
+		fputs(str, stdout);
+		free(str);
+
+		json_decref(obj);
+		if (settings.cache != NULL)
+			cache_close(settings.cache);
+
+		return 0;
+	}
+
+	// Load libdvdcss once, before the workers race to open images
+	DVDInit();
+
+	if (jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs < 1)
+		jobs = 1;
+
+	batch.images = &argv[optind];
+	batch.count = argc - optind;
+	batch.next = 0;
+	batch.list = (batch.count == 0) ? stdin : NULL;
+	batch.settings = &settings;
+	pthread_mutex_init(&batch.lock, NULL);
+
+	workers = malloc(jobs * sizeof(*workers));
+	assert(workers != NULL);
+
+	for (i = 0; i < jobs; i++) {
+		ret = pthread_create(&workers[i], NULL, batch_worker, &batch);
+		assert(ret == 0);
+	}
+	for (i = 0; i < jobs; i++)
+		pthread_join(workers[i], NULL);
 
-	json_decref(obj);
+	free(workers);
+	pthread_mutex_destroy(&batch.lock);
+	if (settings.cache != NULL)
+		cache_close(settings.cache);
 
 	return 0;
 }
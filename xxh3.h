@@ -0,0 +1,389 @@
+// XXH3, 64-bit, seed 0 and the default secret: a streaming implementation
+// of https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md giving
+// the same values as XXH3_64bits().  Stripes are taken in with AVX2 or
+// AVX-512, once xxh3_select() has found them.  Header only, for
+// udf_fingerprint.
+
+#ifndef XXH3_H
+#define XXH3_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XXH3_X86
+#include <immintrin.h>
+#endif
+
+#define XXH3_STRIPE_LEN 64
+#define XXH3_SECRET_SIZE 192
+#define XXH3_STRIPES_PER_BLOCK ((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8)
+#define XXH3_BUFFER_SIZE 256
+#define XXH3_MIDSIZE_MAX 240
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+static const unsigned char xxh3_secret[XXH3_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct xxh3_state {
+	uint64_t acc[8];
+	unsigned char buffer[XXH3_BUFFER_SIZE]; // Its last stripe is kept for the final one
+	size_t buffered;
+	size_t stripes; // Stripes taken into the current block
+	uint64_t total;
+};
+
+static inline uint64_t xxh3_read64(const unsigned char *p) {
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t xxh3_read32(const unsigned char *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t xxh3_rotl64(uint64_t v, int r) {
+	return (v << r) | (v >> (64 - r));
+}
+
+// Low and high halves of the 128-bit product, xored
+static inline uint64_t xxh3_mul128_fold64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)a * b;
+
+	return (uint64_t)p ^ (uint64_t)(p >> 64);
+#else
+	uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+	return lower ^ upper;
+#endif
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len) {
+	h ^= xxh3_rotl64(h, 49) ^ xxh3_rotl64(h, 24);
+	h *= XXH_PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= XXH_PRIME_MX2;
+	return h ^ (h >> 28);
+}
+
+static inline uint64_t xxh3_mix16(const unsigned char *p, const unsigned char *secret) {
+	return xxh3_mul128_fold64(xxh3_read64(p) ^ xxh3_read64(secret),
+	                          xxh3_read64(p + 8) ^ xxh3_read64(secret + 8));
+}
+
+// Inputs of up to XXH3_MIDSIZE_MAX bytes are hashed whole
+static uint64_t xxh3_short(const unsigned char *p, size_t len) {
+	const unsigned char *secret = xxh3_secret;
+	uint64_t acc, end;
+	size_t i;
+
+	if (len == 0)
+		return xxh64_avalanche(xxh3_read64(secret + 56) ^ xxh3_read64(secret + 64));
+	if (len <= 3) {
+		uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) | p[len - 1] | ((uint32_t)len << 8);
+
+		return xxh64_avalanche(combined ^ (uint64_t)(xxh3_read32(secret) ^ xxh3_read32(secret + 4)));
+	}
+	if (len <= 8) {
+		uint64_t input = xxh3_read32(p + len - 4) + ((uint64_t)xxh3_read32(p) << 32);
+
+		return xxh3_rrmxmx(input ^ (xxh3_read64(secret + 8) ^ xxh3_read64(secret + 16)), len);
+	}
+	if (len <= 16) {
+		uint64_t lo = xxh3_read64(p) ^ (xxh3_read64(secret + 24) ^ xxh3_read64(secret + 32));
+		uint64_t hi = xxh3_read64(p + len - 8) ^ (xxh3_read64(secret + 40) ^ xxh3_read64(secret + 48));
+
+		return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + xxh3_mul128_fold64(lo, hi));
+	}
+	acc = len * XXH_PRIME64_1;
+	if (len <= 128) {
+		if (len > 32) {
+			if (len > 64) {
+				if (len > 96) {
+					acc += xxh3_mix16(p + 48, secret + 96);
+					acc += xxh3_mix16(p + len - 64, secret + 112);
+				}
+				acc += xxh3_mix16(p + 32, secret + 64);
+				acc += xxh3_mix16(p + len - 48, secret + 80);
+			}
+			acc += xxh3_mix16(p + 16, secret + 32);
+			acc += xxh3_mix16(p + len - 32, secret + 48);
+		}
+		acc += xxh3_mix16(p, secret);
+		acc += xxh3_mix16(p + len - 16, secret + 16);
+		return xxh3_avalanche(acc);
+	}
+	for (i = 0; i < 8; i++)
+		acc += xxh3_mix16(p + 16 * i, secret + 16 * i);
+	acc = xxh3_avalanche(acc);
+	end = xxh3_mix16(p + len - 16, secret + 136 - 17);
+	for (i = 8; i < len / 16; i++)
+		end += xxh3_mix16(p + 16 * i, secret + 16 * (i - 8) + 3);
+	return xxh3_avalanche(acc + end);
+}
+
+static inline void xxh3_accumulate_512(uint64_t *acc, const unsigned char *p, const unsigned char *secret) {
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t value = xxh3_read64(p + 8 * i);
+		uint64_t key = value ^ xxh3_read64(secret + 8 * i);
+
+		acc[i ^ 1] += value;
+		acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+	}
+}
+
+// Take in count stripes, the secret moving on by 8 bytes for each
+typedef void (*xxh3_accumulate_fn)(uint64_t *, const unsigned char *, size_t, const unsigned char *);
+typedef void (*xxh3_scramble_fn)(uint64_t *, const unsigned char *);
+
+static void xxh3_accumulate_scalar(uint64_t *acc, const unsigned char *p, size_t count, const unsigned char *secret) {
+	for (; count > 0; count--, p += XXH3_STRIPE_LEN, secret += 8)
+		xxh3_accumulate_512(acc, p, secret);
+}
+
+static void xxh3_scramble_scalar(uint64_t *acc, const unsigned char *secret) {
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t a = acc[i];
+
+		a ^= a >> 47;
+		a ^= xxh3_read64(secret + 8 * i);
+		acc[i] = a * XXH_PRIME32_1;
+	}
+}
+
+#ifdef XXH3_X86
+// The same lanes as the scalar code, four or eight 64-bit lanes at a time
+__attribute__((target("avx2")))
+static void xxh3_accumulate_avx2(uint64_t *acc, const unsigned char *p, size_t count, const unsigned char *secret) {
+	__m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+	__m256i a1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+	__m256i value, key;
+
+	for (; count > 0; count--, p += XXH3_STRIPE_LEN, secret += 8) {
+		value = _mm256_loadu_si256((const __m256i *)p);
+		key = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)secret));
+		a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+		a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32)));
+		value = _mm256_loadu_si256((const __m256i *)(p + 32));
+		key = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(secret + 32)));
+		a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+		a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32)));
+	}
+	_mm256_storeu_si256((__m256i *)acc, a0);
+	_mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+
+__attribute__((target("avx2")))
+static void xxh3_scramble_avx2(uint64_t *acc, const unsigned char *secret) {
+	const __m256i prime = _mm256_set1_epi32(XXH_PRIME32_1);
+	__m256i a, hi;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		a = _mm256_loadu_si256((const __m256i *)(acc + 4 * i));
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)(secret + 32 * i)));
+		hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+		a = _mm256_add_epi64(_mm256_mul_epu32(a, prime), _mm256_slli_epi64(hi, 32));
+		_mm256_storeu_si256((__m256i *)(acc + 4 * i), a);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void xxh3_accumulate_avx512(uint64_t *acc, const unsigned char *p, size_t count, const unsigned char *secret) {
+	__m512i a = _mm512_loadu_si512(acc);
+	__m512i value, key;
+
+	for (; count > 0; count--, p += XXH3_STRIPE_LEN, secret += 8) {
+		value = _mm512_loadu_si512(p);
+		key = _mm512_xor_si512(value, _mm512_loadu_si512(secret));
+		a = _mm512_add_epi64(a, _mm512_shuffle_epi32(value, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2)));
+		a = _mm512_add_epi64(a, _mm512_mul_epu32(key, _mm512_srli_epi64(key, 32)));
+	}
+	_mm512_storeu_si512(acc, a);
+}
+
+__attribute__((target("avx512f")))
+static void xxh3_scramble_avx512(uint64_t *acc, const unsigned char *secret) {
+	const __m512i prime = _mm512_set1_epi32(XXH_PRIME32_1);
+	__m512i a = _mm512_loadu_si512(acc), hi;
+
+	a = _mm512_xor_si512(a, _mm512_srli_epi64(a, 47));
+	a = _mm512_xor_si512(a, _mm512_loadu_si512(secret));
+	hi = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), prime);
+	a = _mm512_add_epi64(_mm512_mul_epu32(a, prime), _mm512_slli_epi64(hi, 32));
+	_mm512_storeu_si512(acc, a);
+}
+#endif
+
+static xxh3_accumulate_fn xxh3_accumulate = xxh3_accumulate_scalar;
+static xxh3_scramble_fn xxh3_scramble = xxh3_scramble_scalar;
+
+// Pick the widest stripe code the CPU runs; call before any thread hashes
+static void xxh3_select(void) {
+#ifdef XXH3_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		xxh3_accumulate = xxh3_accumulate_avx512;
+		xxh3_scramble = xxh3_scramble_avx512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		xxh3_accumulate = xxh3_accumulate_avx2;
+		xxh3_scramble = xxh3_scramble_avx2;
+	}
+#endif
+}
+
+// Take in count stripes, scrambling at the end of each block
+static void xxh3_consume(uint64_t *acc, size_t *stripes, const unsigned char *p, size_t count) {
+	size_t n;
+
+	while (count > 0) {
+		n = XXH3_STRIPES_PER_BLOCK - *stripes;
+		if (n > count)
+			n = count;
+		count -= n;
+		xxh3_accumulate(acc, p, n, xxh3_secret + 8 * *stripes);
+		p += n * XXH3_STRIPE_LEN;
+		*stripes += n;
+		if (*stripes == XXH3_STRIPES_PER_BLOCK) {
+			xxh3_scramble(acc, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+			*stripes = 0;
+		}
+	}
+}
+
+static void xxh3_init(struct xxh3_state *state) {
+	static const uint64_t acc[8] = {
+		XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+		XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+	};
+
+	memcpy(state->acc, acc, sizeof(acc));
+	state->buffered = 0;
+	state->stripes = 0;
+	state->total = 0;
+}
+
+static void xxh3_update(struct xxh3_state *state, const void *data, size_t len) {
+	const unsigned char *p = data;
+	size_t n;
+
+	state->total += len;
+	if (len <= XXH3_BUFFER_SIZE - state->buffered) {
+		memcpy(state->buffer + state->buffered, p, len);
+		state->buffered += len;
+		return;
+	}
+
+	// Bytes are only taken in once more follow, the last stripe is special
+	if (state->buffered > 0) {
+		n = XXH3_BUFFER_SIZE - state->buffered;
+		memcpy(state->buffer + state->buffered, p, n);
+		p += n;
+		len -= n;
+		xxh3_consume(state->acc, &state->stripes, state->buffer, XXH3_BUFFER_SIZE / XXH3_STRIPE_LEN);
+		state->buffered = 0;
+	}
+	if (len > XXH3_BUFFER_SIZE) {
+		n = (len - 1) / XXH3_STRIPE_LEN;
+		xxh3_consume(state->acc, &state->stripes, p, n);
+		p += n * XXH3_STRIPE_LEN;
+		len -= n * XXH3_STRIPE_LEN;
+		memcpy(state->buffer + XXH3_BUFFER_SIZE - XXH3_STRIPE_LEN, p - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+	}
+	memcpy(state->buffer, p, len);
+	state->buffered = len;
+}
+
+static uint64_t xxh3_digest(const struct xxh3_state *state) {
+	unsigned char last[XXH3_STRIPE_LEN];
+	const unsigned char *stripe;
+	uint64_t acc[8], result;
+	size_t stripes = state->stripes;
+	size_t n;
+	int i;
+
+	if (state->total <= XXH3_MIDSIZE_MAX)
+		return xxh3_short(state->buffer, state->total);
+
+	memcpy(acc, state->acc, sizeof(acc));
+	if (state->buffered >= XXH3_STRIPE_LEN) {
+		xxh3_consume(acc, &stripes, state->buffer, (state->buffered - 1) / XXH3_STRIPE_LEN);
+		stripe = state->buffer + state->buffered - XXH3_STRIPE_LEN;
+	} else {
+		// The last stripe starts in bytes already taken in
+		n = XXH3_STRIPE_LEN - state->buffered;
+		memcpy(last, state->buffer + XXH3_BUFFER_SIZE - n, n);
+		memcpy(last + n, state->buffer, state->buffered);
+		stripe = last;
+	}
+	xxh3_accumulate(acc, stripe, 1, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7);
+
+	result = state->total * XXH_PRIME64_1;
+	for (i = 0; i < 4; i++)
+		result += xxh3_mul128_fold64(acc[2 * i] ^ xxh3_read64(xxh3_secret + 11 + 16 * i),
+		                             acc[2 * i + 1] ^ xxh3_read64(xxh3_secret + 11 + 16 * i + 8));
+	return xxh3_avalanche(result);
+}
+
+#endif